@@ -0,0 +1,36 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Memory budget for the whole firmware in one place.
+//
+// Tasks, their stacks and the larger buffers are allocated statically, so the link map shows
+// every byte they use and the heap is left for the libraries. Check the sizes against the
+// "mem" USB serial command, which prints each task's stack high-water mark, after changing
+// anything that runs in a task. RTC slow memory is checked after every link by
+// tools/checkRtcSize.py.
+
+// Task stacks in bytes. Set each to the peak use the "mem" report shows for the task plus
+// STACK_MARGIN_BYTES, rounded up to 512, which the report prints as Suggested. The peak is kept
+// in RTC memory from power on, and UI mode logs it with each task's least free stack before
+// deep sleep, warning when that is under STACK_MARGIN_BYTES. Take it from a unit that has
+// calibrated a new card, offloaded over Wi-Fi, served USB with the virtual volume and shown
+// every trend page, since those are the deepest paths. The sizes below have not been measured
+// that way yet, so SPIManagerTask, which does most of that work, keeps a generous stack.
+constexpr uint32_t LOOP_TASK_STACK_SIZE = 8192;			  // setup(), including the Wi-Fi time sync and offload, created by the Arduino core
+constexpr uint32_t SPI_MANAGER_TASK_STACK_SIZE = 16384;	  // Screen, SD card and USB
+constexpr uint32_t BUTTON_TASK_STACK_SIZE = 4096;
+constexpr uint32_t SENSOR_TASK_STACK_SIZE = 10240;	// OneWire scans and reads
+constexpr uint32_t STACK_MARGIN_BYTES = 1024;		// Least free stack that is not logged as a warning
+
+// Static buffers in bytes
+constexpr uint16_t OFFLOAD_BATCH_BYTES = 8192;	  // Log lines sent per HTTP request
+constexpr uint16_t SD_PROBE_CHUNK_BYTES = 4096;	  // SD clock calibration transfers
+
+// RTC slow memory shared by every RTC_DATA_ATTR and RTC_SLOW_ATTR variable, less the part
+// reserved for the ULP coprocessor
+#ifdef CONFIG_ESP32S2_ULP_COPROC_RESERVE_MEM
+constexpr size_t RTC_SLOW_MEMORY_BYTES = 8192 - CONFIG_ESP32S2_ULP_COPROC_RESERVE_MEM;
+#else
+constexpr size_t RTC_SLOW_MEMORY_BYTES = 8192;
+#endif
@@ -0,0 +1,105 @@
+#include "dataOffload.h"
+
+#include <HTTPClient.h>
+
+#include "spiBus.h"
+
+RTC_DATA_ATTR offloadState offload;
+
+/**
+ * @brief Reads the next batch of whole lines from the acknowledged offset.
+ *
+ * @param fileSize Set to the file's size.
+ * @return The batch length, 0 if there is nothing more to send or the read failed.
+ */
+static size_t readBatch(fs::File& file, uint8_t* batch, uint32_t& fileSize) {
+	takeSPIBus();
+	fileSize = file.size();
+	size_t length = file.seek(offload.ackedOffset) ? file.read(batch, OFFLOAD_BATCH_BYTES) : 0;
+	giveSPIBus();
+
+	// Leave a partly written last line for the next batch, unless one line fills the whole batch
+	size_t wholeLines = length;
+	while (wholeLines > 0 && batch[wholeLines - 1] != '\n') {
+		wholeLines--;
+	}
+
+	return wholeLines > 0 || length < OFFLOAD_BATCH_BYTES ? wholeLines : length;
+}
+
+bool offloadWindowDue(time_t now) {
+	// A clock set back since the last window also makes one due
+	return now < offload.windowOpenedAt || now - offload.windowOpenedAt >= OFFLOAD_INTERVAL_S;
+}
+
+void openOffloadWindow(time_t now) {
+	offload.windowOpenedAt = now;
+}
+
+bool offloadPending(const char* path, uint32_t fileSize) {
+	return strcmp(offload.path, path) != 0 ? fileSize > 0 : fileSize > offload.ackedOffset;
+}
+
+offloadReport offloadLogFile(fs::File& file, const char* path, const char* url, const char* unitId) {
+	static uint8_t batch[OFFLOAD_BATCH_BYTES];
+	offloadReport report = {};
+	uint32_t start = millis();
+
+	if (strcmp(offload.path, path) != 0) {
+		strlcpy(offload.path, path, sizeof(offload.path));
+		offload.ackedOffset = 0;
+	}
+
+	const char* fileName = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+
+	HTTPClient http;
+	http.setReuse(true);
+	http.setTimeout(OFFLOAD_HTTP_TIMEOUT_MS);
+	http.setConnectTimeout(OFFLOAD_HTTP_TIMEOUT_MS);
+
+	while (millis() - start < OFFLOAD_TIME_BUDGET_MS) {
+		uint32_t fileSize;
+		size_t length = readBatch(file, batch, fileSize);
+		if (length == 0) {
+			report.complete = offload.ackedOffset >= fileSize;
+			break;
+		}
+
+		if (!http.begin(url)) {
+			ESP_LOGW("Offload", "Bad URL %s", url);
+			break;
+		}
+
+		http.addHeader("Content-Type", "text/csv");
+		http.addHeader("X-Unit-Id", unitId);
+		http.addHeader("X-File", fileName);
+		http.addHeader("X-Offset", String(offload.ackedOffset));
+
+		int status = http.POST(batch, length);
+		long collectorOffset = status > 0 ? http.getString().toInt() : -1;
+
+		if ((status != HTTP_CODE_OK && status != HTTP_CODE_CONFLICT) || collectorOffset < 0 || collectorOffset > static_cast<long>(fileSize)) {
+			ESP_LOGW("Offload", "Collector error %d at offset %u", status, offload.ackedOffset);
+			break;
+		}
+
+		if (status == HTTP_CODE_OK) {
+			report.bytesSent += length;
+			report.batchesSent++;
+		} else {
+			ESP_LOGI("Offload", "Resuming from the collector's offset %ld", collectorOffset);
+		}
+
+		offload.ackedOffset = collectorOffset;
+	}
+
+	http.end();
+
+	report.sendMs = millis() - start;
+	return report;
+}
+
+float offloadBytesPerJoule(uint32_t bytes, uint32_t radioOnMs, uint16_t batteryMilliVolts) {
+	float joules = (batteryMilliVolts / 1000.0f) * (OFFLOAD_RADIO_CURRENT_MA / 1000.0f) * (radioOnMs / 1000.0f);
+	return joules > 0 ? bytes / joules : 0;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include "config.h"
+
+// Sends new log lines to a collector over HTTP.
+//
+// Lines are sent whenever Wi-Fi is up for the time sync, and while recording a full boot opens
+// its own Wi-Fi window for them once OFFLOAD_INTERVAL_S has passed since the last one, if the
+// collector is missing any of the log. A window that cannot connect within
+// OFFLOAD_CONNECT_TIMEOUT_MS still counts, so an unreachable network costs one attempt per
+// interval rather than one per boot.
+//
+// Each batch is POSTed to the collector's URL with the unit ID, the log file name and the
+// batch's byte offset in the file as X-Unit-Id, X-File and X-Offset headers. The collector
+// answers with the number of bytes of that file it has stored: 200 when the batch was
+// appended, 409 when the offset was not where it expected. Either way the unit carries on
+// from the collector's offset, which is kept in RTC memory so the next time sync resumes
+// where this one stopped.
+
+constexpr uint32_t OFFLOAD_INTERVAL_S = 6 * 60 * 60;		// Least time between scheduled Wi-Fi windows
+constexpr uint32_t OFFLOAD_CONNECT_TIMEOUT_MS = 15000;	// Longest a scheduled window waits to connect
+constexpr uint32_t OFFLOAD_TIME_BUDGET_MS = 20000;		// Longest the offload may keep the radio on
+constexpr uint16_t OFFLOAD_HTTP_TIMEOUT_MS = 5000;
+constexpr uint16_t OFFLOAD_RADIO_CURRENT_MA = 120;	// Average current while connected and sending, for the energy estimate
+
+struct offloadState {
+	char path[64];			// The log file being offloaded
+	uint32_t ackedOffset;	// Bytes of it the collector has stored
+	uint32_t windowOpenedAt;	// When the last scheduled Wi-Fi window opened, seconds since 1970
+};
+
+struct offloadReport {
+	uint32_t bytesSent;
+	uint16_t batchesSent;
+	uint32_t sendMs;
+	bool complete;	// The collector has the whole file
+};
+
+/**
+ * @brief Checks whether OFFLOAD_INTERVAL_S has passed since the last scheduled Wi-Fi window.
+ *
+ * @param now The time, seconds since 1970.
+ */
+bool offloadWindowDue(time_t now);
+
+/**
+ * @brief Records that a scheduled Wi-Fi window is opening, whether or not it connects.
+ *
+ * @param now The time, seconds since 1970.
+ */
+void openOffloadWindow(time_t now);
+
+/**
+ * @brief Checks whether the collector is missing any of a log file.
+ *
+ * @param path The log file's path.
+ * @param fileSize The log file's size in bytes.
+ */
+bool offloadPending(const char* path, uint32_t fileSize);
+
+/**
+ * @brief Sends the lines of a log file the collector does not have yet, in batches.
+ *
+ * Batches end at a line ending so the collector only ever stores whole lines. Stops when the
+ * collector has the whole file, a request fails, or OFFLOAD_TIME_BUDGET_MS runs out. The SPI
+ * bus is only held while each batch is read, not while it is sent.
+ *
+ * @param file The log file, open for reading.
+ * @param path The log file's path. Offloading restarts from the beginning when it changes.
+ * @param url The collector's URL.
+ * @param unitId The unit ID sent with every batch.
+ * @return What was sent.
+ */
+offloadReport offloadLogFile(fs::File& file, const char* path, const char* url, const char* unitId);
+
+/**
+ * @brief Estimates how many bytes were offloaded per joule spent with the radio on.
+ *
+ * @param bytes The bytes offloaded.
+ * @param radioOnMs How long Wi-Fi was on, from connecting to disconnecting.
+ * @param batteryMilliVolts The battery voltage.
+ */
+float offloadBytesPerJoule(uint32_t bytes, uint32_t radioOnMs, uint16_t batteryMilliVolts);
@@ -0,0 +1,146 @@
+#include "logFormat.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * @brief Calculate battery percentage based on voltage using a lookup table.
+ *
+ * Lookup table for battery voltage in millivolts and corresponding percentage (based on PANASONIC_NCR_18650_B).
+ * battery voltage 3300 = 3.3V, state of charge 22 = 22%.
+ */
+const uint16_t batteryDischargeCurve[2][12] = {
+	{0, 3300, 3400, 3500, 3600, 3700, 3800, 3900, 4000, 4100, 4200, 9999},
+	{0, 0, 13, 22, 39, 53, 62, 74, 84, 94, 100, 100}};
+
+const char* calculateBatteryPercentage(uint16_t batteryMilliVolts) {
+	static char batteryPercentage[5];  // Static array to hold the battery percentage
+	batteryPercentage[4] = '\0';	   // Null-terminate the array
+
+	// Determine the size of the lookup table
+	uint8_t tableSize = sizeof(batteryDischargeCurve[0]) / sizeof(batteryDischargeCurve[0][0]);
+
+	// Initialize the percentage variable
+	uint8_t percentage = 0;
+
+	// Iterate through the lookup table to find the two lookup values we are between
+	for (uint8_t index = 0; index < tableSize - 1; index++) {
+		// Check if the battery voltage is within the current range
+		if (batteryMilliVolts <= batteryDischargeCurve[0][index + 1]) {
+			// Get the x and y values for interpolation
+			uint16_t x0 = batteryDischargeCurve[0][index];
+			uint16_t x1 = batteryDischargeCurve[0][index + 1];
+			uint8_t y0 = batteryDischargeCurve[1][index];
+			uint8_t y1 = batteryDischargeCurve[1][index + 1];
+
+			// Perform linear interpolation to calculate the battery percentage
+			percentage = static_cast<uint8_t>(y0 + ((y1 - y0) * (batteryMilliVolts - x0)) / (x1 - x0));
+			break;
+		}
+	}
+
+	// Convert the percentage to a char array
+	snprintf(batteryPercentage, sizeof(batteryPercentage), "%u%%", percentage);
+
+	return batteryPercentage;
+}
+
+char* deviceAddressTo4Char(const uint8_t (&address)[8]) {
+	static char result[5];	// Static array to hold the extracted hex characters
+	result[4] = '\0';		// Null-terminate the result array
+
+	// Define a lookup table for hex characters
+	const char hexLookup[] = "0123456789ABCDEF";
+
+	// Extract the hex characters from bytes 1, 3, 5, and 7
+	result[0] = hexLookup[(address[1] >> 4) & 0x0F];
+	result[1] = hexLookup[(address[3] >> 4) & 0x0F];
+	result[2] = hexLookup[(address[5] >> 4) & 0x0F];
+	result[3] = hexLookup[(address[7] >> 4) & 0x0F];
+
+	return result;
+}
+
+char* deviceAddressToHex(const uint8_t (&address)[8]) {
+	static char result[17];
+	const char hexLookup[] = "0123456789ABCDEF";
+
+	for (uint8_t index = 0; index < 8; index++) {
+		result[index * 2] = hexLookup[address[index] >> 4];
+		result[index * 2 + 1] = hexLookup[address[index] & 0x0F];
+	}
+	result[16] = '\0';
+
+	return result;
+}
+
+size_t formatTenths(char* text, int32_t tenths) {
+	char digits[12];
+	uint8_t digitCount = 0;
+	uint32_t magnitude = tenths < 0 ? -static_cast<uint32_t>(tenths) : tenths;
+
+	// Digits in reverse, always at least one before the decimal point
+	do {
+		digits[digitCount++] = '0' + magnitude % 10;
+		magnitude /= 10;
+	} while (magnitude > 0 || digitCount < 2);
+
+	size_t length = 0;
+	text[length++] = ',';
+	if (tenths < 0) {
+		text[length++] = '-';
+	}
+
+	while (digitCount > 1) {
+		text[length++] = digits[--digitCount];
+	}
+	text[length++] = '.';
+	text[length++] = digits[0];
+	text[length] = '\0';
+
+	return length;
+}
+
+size_t formatLogLine(char* line, size_t size, const char* dateTime, uint16_t batteryMilliVolts, const logReading readings[], uint8_t readingCount) {
+	// Format the data line with current date and time, and battery voltage
+	int written = snprintf(line, size, "%s,%u", dateTime, batteryMilliVolts);
+	if (written < 0 || static_cast<size_t>(written) >= size) {
+		return size > 0 ? strlen(line) : 0;
+	}
+	size_t length = written;
+
+	// Append each column at the running length rather than searching for the end each time
+	for (uint8_t index = 0; index < readingCount; index++) {
+		// Room for the longest column formatTenths writes and the null terminator
+		if (size - length < 15) {
+			break;
+		}
+
+		if (readings[index].error) {
+			memcpy(line + length, ",ERR", 5);
+			length += 4;
+		} else {
+			// Same rounding as the history and summaries, and much cheaper than a float printf
+			length += formatTenths(line + length, lroundf(readings[index].temperature * 10));
+		}
+	}
+
+	return length;
+}
+
+const char* formatDateTime(time_t epoch, const char* format) {
+	static char dateTime[32];
+	struct tm* timeInfo = localtime(&epoch);
+	strftime(dateTime, sizeof(dateTime), format, timeInfo);
+	return dateTime;
+}
+
+const char* getCurrentDateTime(const char* format) {
+	return formatDateTime(time(nullptr), format);
+}
+
+uint8_t nextAlarmMinute(uint8_t minute, uint8_t intervalMins) {
+	uint8_t alarmMinute = minute + intervalMins - (minute % intervalMins);
+	return alarmMinute >= 60 ? 0 : alarmMinute;
+}
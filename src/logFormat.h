@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Text for log lines and the screen, and the alarm arithmetic on the same wake path.
+//
+// Nothing here uses Arduino or ESP-IDF headers, so tools/logFormatBench.cpp can time these
+// functions on the host and check them against tools/logFormatBench.baseline.
+
+// The columns before the sensors, then a column per sensor named by its ROM code. Rows hold the
+// local time and its offset from UTC, as in "2023-06-23,20:41,+1200,3712,21.5".
+constexpr const char* LOG_HEADER_FIXED_COLUMNS = "Date(YYYY-MM-DD),Time(HH:MM),UTC Offset(+HHMM),Battery(mV)";
+constexpr const char* LOG_DATE_TIME_FORMAT = "%Y-%m-%d,%H:%M,%z";
+
+// The summary file written next to each log, described in periodSummary.h
+constexpr uint8_t SUMMARY_PERIOD_COUNT = 2;
+constexpr uint32_t summaryPeriodSeconds[SUMMARY_PERIOD_COUNT] = {60 * 60, 24 * 60 * 60};
+constexpr const char* summaryPeriodNames[SUMMARY_PERIOD_COUNT] = {"Hour", "Day"};
+constexpr const char* SUMMARY_HEADER = "Period,Start(YYYY-MM-DD HH:MM),Sensor,Count,Mean,StdDev,Min,MinTime(HH:MM),Max,MaxTime(HH:MM),Errors";
+
+// A sensor's column in a log line
+struct logReading {
+	float temperature;
+	bool error;	 // Logged as ERR
+};
+
+/**
+ * @brief Calculate battery percentage based on voltage.
+ *
+ * @param batteryMilliVolts The battery voltage in millivolts.
+ * @return The battery percentage as a null-terminated char array.
+ */
+const char* calculateBatteryPercentage(uint16_t batteryMilliVolts);
+
+/**
+ * @brief Extracts the first hex character from byte 1, 3, 5, and 7 of a DeviceAddress.
+ *
+ * This function takes a DeviceAddress, which is an array of bytes representing a device address,
+ * and extracts the first hex character from bytes 1, 3, 5, and 7. The result is stored in a static
+ * character array and returned. The result array is null-terminated.
+ *
+ * @param address The DeviceAddress from which to extract the hex characters.
+ * @return A pointer to the static character array holding the extracted hex characters.
+ */
+char* deviceAddressTo4Char(const uint8_t (&address)[8]);
+
+/**
+ * @brief Writes a DeviceAddress as its 16 hex digits, family code first, as in "28FF641E8316034B".
+ *
+ * @param address The DeviceAddress to convert.
+ * @return A pointer to a static character array holding the hex digits.
+ */
+char* deviceAddressToHex(const uint8_t (&address)[8]);
+
+/**
+ * @brief Writes a temperature in tenths of a degree as ",21.5" or ",-0.5".
+ *
+ * @param text Where to write, with room for 14 characters.
+ * @param tenths The temperature in tenths of a degree.
+ * @return The number of characters written, not counting the null terminator.
+ */
+size_t formatTenths(char* text, int32_t tenths);
+
+/**
+ * @brief Formats a log line, without its line ending.
+ *
+ * Temperatures are rounded to the nearest tenth like the history and summaries. Columns that
+ * don't fit in size are left off rather than cut short.
+ *
+ * @param line Where to write, with room for 64 characters and 8 per reading.
+ * @param size The size of line.
+ * @param dateTime The date, time and UTC offset columns.
+ * @param batteryMilliVolts The battery voltage column.
+ * @param readings A column per sensor.
+ * @param readingCount The number of readings.
+ * @return The length of the line.
+ */
+size_t formatLogLine(char* line, size_t size, const char* dateTime, uint16_t batteryMilliVolts, const logReading readings[], uint8_t readingCount);
+
+/**
+ * @brief Formats a time as a local date and time string.
+ *
+ * @param epoch The time to format.
+ * @param format The desired format of the date and time string.
+ * @return The date and time as a formatted string.
+ */
+const char* formatDateTime(time_t epoch, const char* format);
+
+/**
+ * @brief Get the current date and time as a formatted string.
+ *
+ * @param format The desired format of the date and time string.
+ * @return The current date and time as a formatted string.
+ */
+const char* getCurrentDateTime(const char* format);
+
+/**
+ * @brief Calculates the minute of the next alarm, the next multiple of the recording interval.
+ *
+ * If the current minute is already aligned with the interval the alarm is a whole interval
+ * away. An alarm minute of 60 or more wraps around to 0, the start of the next hour.
+ *
+ * @param minute The current minute.
+ * @param intervalMins The recording interval in minutes.
+ * @return The alarm minute, 0 to 59.
+ */
+uint8_t nextAlarmMinute(uint8_t minute, uint8_t intervalMins);
@@ -7,10 +7,23 @@
 
 #include "USB.h"
 #include "USBMSC.h"
+#include "config.h"
 #include "credentials.h"
+#include "dataOffload.h"
+#include "esp_heap_caps.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
+#include "hal/gpio_ll.h"
+#include "logFormat.h"
 #include "pcf8563.h"
+#include "periodSummary.h"
+#include "sdClock.h"
 #include "sntp.h"
+#include "spiBus.h"
+#include "temperatureHistory.h"
 #include "time.h"
+#include "virtualFat.h"
+#include "wakeStub.h"
 
 #ifndef CREDENTIALS_H
 #define CREDENTIALS_H
@@ -20,10 +33,25 @@
 
 #endif
 
+// 1 to show the computer a read-only copy of the SD card over USB, so logging can continue while plugged in
+#ifndef USB_VIRTUAL_VOLUME
+#define USB_VIRTUAL_VOLUME 0
+#endif
+
+// Collector that new log lines are sent to while Wi-Fi is up, for example "http://192.168.1.10:8080/", empty to disable
+#ifndef OFFLOAD_URL
+#define OFFLOAD_URL ""
+#endif
+
 // Constants
 constexpr uint8_t SCREEN_ON_TIME = 30;
 constexpr uint16_t HOLD_DURATION = 3000;
 constexpr uint8_t ONEWIRE_TEMP_RESOLUTION = 10;
+constexpr uint16_t SAMPLE_INTERVAL_MS = 1000;	   // UI mode sensor sampling period
+constexpr uint8_t BATTERY_SAMPLE_INTERVAL = 5;	   // Read the battery every n sensor samples
+constexpr uint16_t REC_BLINK_INTERVAL_MS = 500;
+constexpr uint8_t BACKLIGHT_PWM_CHANNEL = 0;
+constexpr uint32_t WIFI_SYNC_TIMEOUT_MS = 30000;  // Longest the time sync waits for an NTP server
 
 const uint8_t batterySmoothingFactor = 5;	   // Example: 10 represents 10% of new value
 const float temperatureSmoothingFactor = 0.5;  // Smaller values for slower response, larger values for faster response with more noise
@@ -46,12 +74,156 @@ PCF8563_Class rtc;
 bool systemTimeValid = false;
 bool recordingDot = true;
 bool sensorsChanged = false;
-
-SemaphoreHandle_t buttonSemaphore;
+uint8_t screenPage = 0;	 // 0 for live readings, otherwise 1 + the history level shown
+
+// UI mode events
+constexpr EventBits_t SAMPLE_READY_BIT = BIT0;	   // readOneWireTemperaturesTask has new readings
+constexpr EventBits_t USB_CHANGED_BIT = BIT1;	   // VUSB_SENSE was attached or detached
+constexpr EventBits_t SCREEN_TIMEOUT_BIT = BIT2;  // screenTimer expired
+constexpr EventBits_t PAGE_CHANGED_BIT = BIT3;	   // screenPage was changed with the up/down buttons
+constexpr EventBits_t LOG_DUE_BIT = BIT4;		   // The RTC alarm fired while awake
+
+// Button task notification bits
+constexpr uint32_t WAKE_BUTTON_EDGE = BIT0;
+constexpr uint32_t UP_BUTTON_EDGE = BIT1;
+constexpr uint32_t DOWN_BUTTON_EDGE = BIT2;
+
+EventGroupHandle_t uiEvents;
+TimerHandle_t screenTimer;
+TaskHandle_t buttonTaskHandle;
+TaskHandle_t spiManagerTaskHandle;
+TaskHandle_t sensorTaskHandle;
+TaskHandle_t loopTaskHandle;
+
+// RTOS objects and task stacks, allocated statically with the sizes in config.h
+StaticEventGroup_t uiEventsBuffer;
+StaticTimer_t screenTimerBuffer;
+StaticTask_t spiManagerTaskBuffer;
+StaticTask_t buttonTaskBuffer;
+StaticTask_t sensorTaskBuffer;
+StackType_t spiManagerTaskStack[SPI_MANAGER_TASK_STACK_SIZE];
+StackType_t buttonTaskStack[BUTTON_TASK_STACK_SIZE];
+StackType_t sensorTaskStack[SENSOR_TASK_STACK_SIZE];
+
+// The Arduino core creates the task setup() runs in
+SET_LOOP_TASK_STACK_SIZE(LOOP_TASK_STACK_SIZE);
 
 USBMSC MSC;
 USBCDC USBSerial;
 
+// Power management lock with hold time statistics
+struct powerLock {
+	const char* name;
+	esp_pm_lock_type_t type;
+	esp_pm_lock_handle_t handle;
+	uint8_t holders;	  // Tasks holding the lock now, it is shared between tasks
+	int64_t acquiredAt;	  // When holders went from 0 to 1
+	uint32_t holdCount;	  // Acquisitions
+	int64_t totalHeldUs;  // Time with at least one holder
+	int64_t maxHeldUs;
+};
+
+// Guards the statistics of every powerLock, which are updated from several tasks
+portMUX_TYPE powerLockStatsMux = portMUX_INITIALIZER_UNLOCKED;
+
+// One lock per subsystem, each held only while that subsystem needs the clock
+powerLock usbMscLock = {"usb_msc", ESP_PM_CPU_FREQ_MAX};		 // USB mass storage transfers
+powerLock displayLock = {"spi_display", ESP_PM_APB_FREQ_MAX};	 // Pushing pixels over SPI
+powerLock sdFlushLock = {"sd_flush", ESP_PM_APB_FREQ_MAX};		 // Writing the log to the SD card over SPI
+powerLock oneWireLock = {"onewire", ESP_PM_CPU_FREQ_MAX};		 // Bit-banged OneWire time slots
+powerLock wifiSyncLock = {"wifi_sync", ESP_PM_CPU_FREQ_MAX};	 // Wi-Fi and SNTP time sync
+powerLock* const powerLocks[] = {&usbMscLock, &displayLock, &sdFlushLock, &oneWireLock, &wifiSyncLock};
+
+/**
+ * @brief Creates every power management lock, before any task can use them.
+ */
+void createPowerLocks() {
+	for (powerLock* lock : powerLocks) {
+		esp_pm_lock_create(lock->type, 0, lock->name, &lock->handle);
+	}
+}
+
+/**
+ * @brief Acquires a power management lock and starts timing how long it is held.
+ *
+ * Statistics are kept even if power management is unavailable, in which case the CPU simply
+ * stays at its fixed frequency. Overlapping holds from different tasks are timed as one hold,
+ * from the first acquire to the last release.
+ *
+ * @param lock The subsystem lock to acquire.
+ */
+void acquirePowerLock(powerLock& lock) {
+	if (lock.handle != nullptr) {
+		esp_pm_lock_acquire(lock.handle);
+	}
+
+	int64_t now = esp_timer_get_time();
+
+	portENTER_CRITICAL(&powerLockStatsMux);
+	if (lock.holders++ == 0) {
+		lock.acquiredAt = now;
+	}
+	lock.holdCount++;
+	portEXIT_CRITICAL(&powerLockStatsMux);
+}
+
+/**
+ * @brief Releases a power management lock and records how long it was held.
+ *
+ * @param lock The subsystem lock to release.
+ */
+void releasePowerLock(powerLock& lock) {
+	int64_t now = esp_timer_get_time();
+
+	portENTER_CRITICAL(&powerLockStatsMux);
+	if (lock.holders > 0 && --lock.holders == 0) {
+		int64_t heldUs = now - lock.acquiredAt;
+
+		lock.totalHeldUs += heldUs;
+		if (heldUs > lock.maxHeldUs) {
+			lock.maxHeldUs = heldUs;
+		}
+	}
+	portEXIT_CRITICAL(&powerLockStatsMux);
+
+	if (lock.handle != nullptr) {
+		esp_pm_lock_release(lock.handle);
+	}
+}
+
+/**
+ * @brief Prints the hold time statistics of every power management lock to USBSerial.
+ */
+void printPowerLockStats() {
+	USBSerial.printf("%-12s %8s %12s %10s\r\n", "Lock", "Holds", "Total(ms)", "Max(us)");
+
+	for (const powerLock* lock : powerLocks) {
+		// Copy under the lock so a release in another task cannot tear the 64-bit totals
+		portENTER_CRITICAL(&powerLockStatsMux);
+		powerLock stats = *lock;
+		portEXIT_CRITICAL(&powerLockStatsMux);
+
+		USBSerial.printf("%-12s %8u %12llu %10llu\r\n", stats.name, stats.holdCount, stats.totalHeldUs / 1000, stats.maxHeldUs);
+	}
+
+	USBSerial.printf("CPU: %u MHz, uptime: %llu ms\r\n", getCpuFrequencyMhz(), esp_timer_get_time() / 1000);
+}
+
+/**
+ * @brief Prints the SD card clock calibration to the USB serial port.
+ */
+void printSDClockCalibration() {
+	const sdClockCalibration& calibration = getSDClockCalibration();
+
+	if (calibration.frequency == 0) {
+		USBSerial.printf("SD card not calibrated\r\n");
+		return;
+	}
+
+	USBSerial.printf("Card %08x: %u kHz, write %.2f MB/s, read %.2f MB/s, %u errors while probing\r\n", calibration.cardKey, calibration.frequency / 1000,
+					 calibration.writeMBps, calibration.readMBps, calibration.errors);
+}
+
 auto configurePin = [](int pin, int mode, int initialState) {
 	pinMode(pin, mode);
 	digitalWrite(pin, initialState);
@@ -60,13 +232,47 @@ auto configurePin = [](int pin, int mode, int initialState) {
 // For this to work with Espressif's ESP32 code you need to change line 694 esp32 / hardware / eps32 / 2.0.3 / libraries / SD / src / sd_diskio.cpp
 
 static int32_t onWrite(uint32_t lba, uint32_t offset, uint8_t* buffer, uint32_t bufsize) {
-	return SD.writeRAW((uint8_t*)buffer, lba) ? bufsize : -1;
+	acquirePowerLock(usbMscLock);
+	takeSPIBus();
+	bool success = SD.writeRAW((uint8_t*)buffer, lba);
+	giveSPIBus();
+	releasePowerLock(usbMscLock);
+	return success ? bufsize : -1;
 }
 
 static int32_t onRead(uint32_t lba, uint32_t offset, void* buffer, uint32_t bufsize) {
-	return SD.readRAW((uint8_t*)buffer, lba) ? bufsize : -1;
+	acquirePowerLock(usbMscLock);
+	takeSPIBus();
+	bool success = SD.readRAW((uint8_t*)buffer, lba);
+	giveSPIBus();
+	releasePowerLock(usbMscLock);
+	return success ? bufsize : -1;
+}
+
+#if USB_VIRTUAL_VOLUME
+static bool readCardSector(uint32_t lba, uint8_t* buffer) {
+	return SD.readRAW(buffer, lba);
 }
 
+static int32_t onVirtualWrite(uint32_t lba, uint32_t offset, uint8_t* buffer, uint32_t bufsize) {
+	return -1;	// The virtual volume is read-only
+}
+
+static int32_t onVirtualRead(uint32_t lba, uint32_t offset, void* buffer, uint32_t bufsize) {
+	acquirePowerLock(usbMscLock);
+	takeSPIBus();  // Also keeps the card's files from changing underneath the volume
+
+	bool success = true;
+	for (uint32_t sector = 0; success && sector < bufsize / VIRTUAL_SECTOR_SIZE; sector++) {
+		success = readVirtualSector(lba + sector, static_cast<uint8_t*>(buffer) + sector * VIRTUAL_SECTOR_SIZE);
+	}
+
+	giveSPIBus();
+	releasePowerLock(usbMscLock);
+	return success ? bufsize : -1;
+}
+#endif
+
 static bool onStartStop(uint8_t power_condition, bool start, bool load_eject) {
 	return true;
 }
@@ -78,13 +284,15 @@ struct temperatureSensor {
 	bool error;
 };
 
+const uint8_t maxSensorsPerPort = 5;
+
 // Struct to hold information about a temperature sensor bus
 struct temperatureSensorBus {
 	uint8_t numberOfSensors;
 	uint8_t oneWirePin;
 	OneWire oneWireBus;
 	DallasTemperature dallasTemperatureBus;
-	temperatureSensor sensorList[5];
+	temperatureSensor sensorList[maxSensorsPerPort];
 	uint32_t color;
 };
 
@@ -100,87 +308,358 @@ const uint8_t oneWirePortCount = 3;
 RTC_DATA_ATTR temperatureSensorBus oneWirePort[oneWirePortCount];
 RTC_DATA_ATTR sdCard microSDCard;
 
+static_assert(oneWirePortCount * maxSensorsPerPort == HISTORY_SENSOR_COUNT, "History needs a slot per sensor");
+static_assert(oneWirePortCount * maxSensorsPerPort == SUMMARY_SENSOR_COUNT, "Summaries need a slot per sensor");
+static_assert(oneWirePortCount == WAKE_STUB_PORT_COUNT && maxSensorsPerPort == WAKE_STUB_SENSORS_PER_PORT, "The wake stub needs a slot per sensor");
+
+// Guards oneWirePort's sensor lists and readings, which the sensor task updates while the SPI
+// manager task logs. Recursive, so a function holding it can call another that takes it. A
+// task that needs the SPI bus as well takes the bus first.
+SemaphoreHandle_t sensorsMutex;
+StaticSemaphore_t sensorsMutexBuffer;
+
+/**
+ * @brief Creates the sensors lock, before any task can use the sensors.
+ */
+void createSensorsLock() {
+	sensorsMutex = xSemaphoreCreateRecursiveMutexStatic(&sensorsMutexBuffer);
+}
+
+/**
+ * @brief Waits for and takes the sensors. Every take must be matched by a giveSensors() in the same task.
+ */
+void takeSensors() {
+	xSemaphoreTakeRecursive(sensorsMutex, portMAX_DELAY);
+}
+
+/**
+ * @brief Gives the sensors back.
+ */
+void giveSensors() {
+	xSemaphoreGiveRecursive(sensorsMutex);
+}
+
+// RTC slow memory sections, from the linker script. Every RTC_DATA_ATTR, RTC_NOINIT_ATTR and
+// RTC_SLOW_ATTR variable is in one of them, including any in libraries, and the size of each
+// includes its alignment padding. tools/checkRtcSize.py checks the same sections at build time.
+extern "C" char _rtc_data_start[], _rtc_data_end[], _rtc_bss_start[], _rtc_bss_end[];
+extern "C" char _rtc_noinit_start[], _rtc_noinit_end[], _rtc_force_slow_start[], _rtc_force_slow_end[];
+
+// Every task whose stack size is set in config.h
+struct taskStack {
+	const char* name;
+	TaskHandle_t* handle;  // Null until the task is created
+	uint32_t size;
+};
+const taskStack taskStacks[] = {
+	{"loopTask", &loopTaskHandle, LOOP_TASK_STACK_SIZE},
+	{"SPIManager", &spiManagerTaskHandle, SPI_MANAGER_TASK_STACK_SIZE},
+	{"Button", &buttonTaskHandle, BUTTON_TASK_STACK_SIZE},
+	{"Sensors", &sensorTaskHandle, SENSOR_TASK_STACK_SIZE},
+};
+constexpr uint8_t taskStackCount = sizeof(taskStacks) / sizeof(taskStacks[0]);
+
+// The most stack each task has used in any session since power on
+RTC_DATA_ATTR uint32_t taskStackPeakUsed[taskStackCount];
+
 /**
- * @brief Extracts the first hex character from byte 1, 3, 5, and 7 of a DeviceAddress.
+ * @brief Adds the task's current high-water mark to its peak use since power on.
  *
- * This function takes a DeviceAddress, which is an array of bytes representing a device address,
- * and extracts the first hex character from bytes 1, 3, 5, and 7. The result is stored in a static
- * character array and returned. The result array is null-terminated.
+ * @return The peak in bytes, or 0 if the task has not been created.
+ */
+static uint32_t updateStackPeak(uint8_t index) {
+	const taskStack& task = taskStacks[index];
+	if (*task.handle == nullptr) {
+		return 0;
+	}
+
+	uint32_t used = task.size - uxTaskGetStackHighWaterMark(*task.handle);
+	taskStackPeakUsed[index] = max(taskStackPeakUsed[index], used);
+	return taskStackPeakUsed[index];
+}
+
+/**
+ * @brief The stack size a task needs for its peak use with STACK_MARGIN_BYTES spare, in whole 512 byte steps.
+ */
+static uint32_t suggestedStackSize(uint32_t peakUsed) {
+	return (peakUsed + STACK_MARGIN_BYTES + 511) / 512 * 512;
+}
+
+/**
+ * @brief Logs the least free stack each UI mode task has had, warning when it is under STACK_MARGIN_BYTES.
  *
- * @param address The DeviceAddress from which to extract the hex characters.
- * @return A pointer to the static character array holding the extracted hex characters.
+ * Called as UI mode ends, so the debug log records the deepest stack use of every session, and
+ * the peak since power on is kept for the "mem" report.
  */
-char* deviceAddressTo4Char(const DeviceAddress& address) {
-	static char result[5];	// Static array to hold the extracted hex characters
-	result[4] = '\0';		// Null-terminate the result array
+void logStackHighWaterMarks() {
+	for (uint8_t i = 0; i < taskStackCount; i++) {
+		const taskStack& task = taskStacks[i];
+		if (*task.handle == nullptr) {
+			continue;
+		}
 
-	// Define a lookup table for hex characters
-	const char hexLookup[] = "0123456789ABCDEF";
+		uint32_t minimumFree = uxTaskGetStackHighWaterMark(*task.handle);
+		uint32_t peakUsed = updateStackPeak(i);
+		if (minimumFree < STACK_MARGIN_BYTES) {
+			ESP_LOGW("Stack", "%s: %u of %u bytes free at worst, %u used at peak since power on", task.name, minimumFree, task.size, peakUsed);
+		} else {
+			ESP_LOGI("Stack", "%s: %u of %u bytes free at worst, %u used at peak since power on", task.name, minimumFree, task.size, peakUsed);
+		}
+	}
+}
 
-	// Extract the hex characters from bytes 1, 3, 5, and 7
-	result[0] = hexLookup[(address[1] >> 4) & 0x0F];
-	result[1] = hexLookup[(address[3] >> 4) & 0x0F];
-	result[2] = hexLookup[(address[5] >> 4) & 0x0F];
-	result[3] = hexLookup[(address[7] >> 4) & 0x0F];
+/**
+ * @brief Prints each task's stack use, the heap and the RTC slow memory use to USBSerial.
+ *
+ * MinFree is the least free stack the task has had since it started, and PeakUsed the most it
+ * has used in any session since power on. Suggested is PeakUsed plus STACK_MARGIN_BYTES, the
+ * size to give the task in config.h once every feature has been exercised.
+ */
+void printMemoryReport() {
+	USBSerial.printf("%-12s %8s %10s %10s %10s\r\n", "Task", "Stack", "MinFree", "PeakUsed", "Suggested");
+	for (uint8_t i = 0; i < taskStackCount; i++) {
+		const taskStack& task = taskStacks[i];
+		if (*task.handle != nullptr) {
+			uint32_t peakUsed = updateStackPeak(i);
+			USBSerial.printf("%-12s %8u %10u %10u %10u\r\n", task.name, task.size, uxTaskGetStackHighWaterMark(*task.handle), peakUsed,
+							 suggestedStackSize(peakUsed));
+		}
+	}
 
-	return result;
+	USBSerial.printf("Heap: %u free, %u minimum free, %u largest block\r\n", heap_caps_get_free_size(MALLOC_CAP_8BIT),
+					 heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT), heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+
+	// The sections are placed one after another, so the span includes the padding between them
+	size_t rtcUsed = _rtc_force_slow_end - _rtc_data_start;
+	size_t rtcData = _rtc_data_end - _rtc_data_start;
+	size_t rtcBss = _rtc_bss_end - _rtc_bss_start;
+	size_t rtcNoInit = _rtc_noinit_end - _rtc_noinit_start;
+	size_t rtcForceSlow = _rtc_force_slow_end - _rtc_force_slow_start;
+	USBSerial.printf("RTC slow: %u of %u bytes (data %u, bss %u, noinit %u, force slow %u)\r\n", rtcUsed, RTC_SLOW_MEMORY_BYTES, rtcData, rtcBss, rtcNoInit,
+					 rtcForceSlow);
 }
 
 /**
- * @brief Interrupt handler for the button press.
+ * @brief Handles commands typed into the USB serial port.
  *
- * This function is called when the button interrupt is triggered. It gives the button semaphore,
- * allowing the button task to proceed. It also yields to a higher priority task if necessary.
+ * Commands are single lines:
+ * - pm: print power management lock statistics
+ * - sd: print the SD card clock calibration
+ * - mem: print the stack, heap and RTC memory report
+ */
+static void onUSBSerialEvent(void* arg, esp_event_base_t eventBase, int32_t eventId, void* eventData) {
+	static char command[16];
+	static uint8_t length = 0;
+
+	while (USBSerial.available()) {
+		char c = USBSerial.read();
+
+		if (c == '\r' || c == '\n') {
+			command[length] = '\0';
+
+			if (strcmp(command, "pm") == 0) {
+				printPowerLockStats();
+			} else if (strcmp(command, "sd") == 0) {
+				printSDClockCalibration();
+			} else if (strcmp(command, "mem") == 0) {
+				printMemoryReport();
+			} else if (length > 0) {
+				USBSerial.printf("Unknown command: %s\r\n", command);
+			}
+
+			length = 0;
+		} else if (length < sizeof(command) - 1) {
+			command[length++] = c;
+		}
+	}
+}
+
+
+/**
+ * @brief Re-arms a level triggered pin interrupt for the opposite level.
+ *
+ * Edge interrupts cannot wake the chip from light sleep but level interrupts can. Flipping the
+ * trigger level after every interrupt gives exactly one interrupt per press and one per release.
+ *
+ * @param pin The GPIO that raised the interrupt.
+ * @return The level of the pin when the interrupt was handled.
+ */
+static inline bool IRAM_ATTR rearmLevelInterrupt(uint8_t pin) {
+	bool level = gpio_ll_get_level(&GPIO, static_cast<gpio_num_t>(pin));
+	gpio_ll_set_intr_type(&GPIO, static_cast<gpio_num_t>(pin), level ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+	return level;
+}
+
+/**
+ * @brief Attaches a level triggered interrupt that can also wake the chip from light sleep.
+ *
+ * @param pin The GPIO to watch.
+ * @param handler The interrupt handler, which must call rearmLevelInterrupt().
+ */
+void attachWakeInterrupt(uint8_t pin, void (*handler)()) {
+	pinMode(pin, INPUT);
+	bool level = digitalRead(pin);
+	attachInterrupt(digitalPinToInterrupt(pin), handler, level ? ONLOW : ONHIGH);
+	gpio_wakeup_enable(static_cast<gpio_num_t>(pin), level ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+}
+
+/**
+ * @brief Notifies the button task of a button press or release.
+ *
+ * This function is called on every edge of a button. It notifies the button task, and yields
+ * to it if it has a higher priority than the interrupted task.
+ *
+ * @param pin The button GPIO.
+ * @param edgeBit The notification bit for the button.
+ */
+static inline void IRAM_ATTR notifyButtonTaskFromISR(uint8_t pin, uint32_t edgeBit) {
+	rearmLevelInterrupt(pin);
+
+	BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+	xTaskNotifyFromISR(buttonTaskHandle, edgeBit, eSetBits, &xHigherPriorityTaskWoken);
+	portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
+
+void IRAM_ATTR buttonInterrupt() {
+	notifyButtonTaskFromISR(WAKE_BUTTON, WAKE_BUTTON_EDGE);
+}
+
+void IRAM_ATTR upButtonInterrupt() {
+	notifyButtonTaskFromISR(UP_BUTTON, UP_BUTTON_EDGE);
+}
+
+void IRAM_ATTR downButtonInterrupt() {
+	notifyButtonTaskFromISR(DOWN_BUTTON, DOWN_BUTTON_EDGE);
+}
+
+/**
+ * @brief Interrupt handler for USB being attached or detached.
  */
-void buttonInterrupt() {
+void IRAM_ATTR usbSenseInterrupt() {
+	rearmLevelInterrupt(VUSB_SENSE);
+
 	BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-	xSemaphoreGiveFromISR(buttonSemaphore, &xHigherPriorityTaskWoken);
+	xEventGroupSetBitsFromISR(uiEvents, USB_CHANGED_BIT, &xHigherPriorityTaskWoken);
 	portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
 }
 
+#if USB_VIRTUAL_VOLUME
+/**
+ * @brief Interrupt handler for the RTC alarm pin, which goes high when a log line is due.
+ */
+void IRAM_ATTR rtcAlarmInterrupt() {
+	if (rearmLevelInterrupt(WIRE_RTC_INT)) {
+		BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+		xEventGroupSetBitsFromISR(uiEvents, LOG_DUE_BIT, &xHigherPriorityTaskWoken);
+		portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+	}
+}
+#endif
+
 /**
- * @brief Get the current date and time as a formatted string.
+ * @brief Timer callback for the screen on time running out.
+ */
+void screenTimeoutCallback(TimerHandle_t timer) {
+	xEventGroupSetBits(uiEvents, SCREEN_TIMEOUT_BIT);
+}
+
+/**
+ * @brief Configures dynamic frequency scaling and automatic light sleep.
+ *
+ * The CPU runs from the crystal when idle and only goes up to full speed while a subsystem holds
+ * a power lock. With light sleep enabled, the idle task puts the chip into light sleep whenever
+ * every task is blocked waiting for an event. USB needs the PLL running, so while it is attached
+ * the minimum frequency stays at 80 MHz and light sleep is disabled.
+ *
+ * Light sleep needs tickless idle, which the Arduino core's prebuilt configuration leaves off, so
+ * esp_pm_configure() rejects the whole configuration there. It is then applied again without
+ * light sleep so frequency scaling still works.
+ *
+ * @param usbAttached Whether USB is attached.
+ * @param allowLightSleep Whether the idle task may enter light sleep.
+ * @return True if power management was configured.
+ */
+bool configurePowerManagement(bool usbAttached, bool allowLightSleep) {
+	esp_pm_config_esp32s2_t pmConfig = {
+		.max_freq_mhz = 240,
+		.min_freq_mhz = usbAttached ? 80 : static_cast<int>(getXtalFrequencyMhz()),
+		.light_sleep_enable = allowLightSleep && !usbAttached,
+	};
+
+	esp_err_t err = esp_pm_configure(&pmConfig);
+	if (err == ESP_ERR_NOT_SUPPORTED && pmConfig.light_sleep_enable) {
+		ESP_LOGI("Power Management", "Light sleep unavailable, using DFS only");
+		pmConfig.light_sleep_enable = false;
+		err = esp_pm_configure(&pmConfig);
+	}
+
+	if (err != ESP_OK) {
+		ESP_LOGW("Power Management", "DFS unavailable: %s", esp_err_to_name(err));
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Fades the backlight in or out gradually.
  *
- * @param format The desired format of the date and time string.
- * @return The current date and time as a formatted string.
+ * The LEDC peripheral stops in light sleep, so once the fade is finished the backlight is held
+ * fully on or off with a plain GPIO level instead.
+ *
+ * @param fadeIn True to fade in, false to fade out.
  */
-const char* getCurrentDateTime(const char* format) {
-	static char dateTime[32];
-	time_t currentEpoch;
-	time(&currentEpoch);
-	struct tm* timeInfo = localtime(&currentEpoch);
-	strftime(dateTime, sizeof(dateTime), format, timeInfo);
-	return dateTime;
+void fadeBacklight(bool fadeIn) {
+	ledcSetup(BACKLIGHT_PWM_CHANNEL, 5000, 8);
+	ledcAttachPin(BACKLIGHT, BACKLIGHT_PWM_CHANNEL);
+
+	for (uint16_t step = 0; step < 256; step++) {
+		ledcWrite(BACKLIGHT_PWM_CHANNEL, fadeIn ? step : 255 - step);
+		vTaskDelay(5 / portTICK_PERIOD_MS);
+	}
+
+	ledcDetachPin(BACKLIGHT);
+	configurePin(BACKLIGHT, OUTPUT, fadeIn ? HIGH : LOW);
+}
+
+/**
+ * @brief Converts a calendar date and time to seconds since 1970, without any timezone adjustment.
+ *
+ * @return The number of seconds between 1970-01-01 00:00:00 and the given date and time.
+ */
+uint32_t dateTimeToSeconds(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second) {
+	// Count years from March so the leap day is the last day of the year
+	uint32_t marchYear = year - (month <= 2 ? 1 : 0);
+	uint32_t era = marchYear / 400;
+	uint32_t yearOfEra = marchYear - era * 400;
+	uint32_t dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+	uint32_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+	uint32_t days = era * 146097 + dayOfEra - 719468;  // 719468 days from 0000-03-01 to 1970-01-01
+
+	return days * 86400 + hour * 3600 + minute * 60 + second;
+}
+
+/**
+ * @brief Converts a time to the local wall clock time as seconds since 1970.
+ *
+ * Periods such as days line up with local midnight when counted in these seconds.
+ */
+uint32_t getLocalSeconds(time_t epoch) {
+	struct tm* timeInfo = localtime(&epoch);
+	return dateTimeToSeconds(timeInfo->tm_year + 1900, timeInfo->tm_mon + 1, timeInfo->tm_mday, timeInfo->tm_hour, timeInfo->tm_min, timeInfo->tm_sec);
 }
 
 /**
  * @brief Sets up the next alarm based on the current time and recording interval.
  *
- * This function calculates the next alarm minute based on the current time and the specified
- * recording interval. If the current minute is not aligned with the recording interval, it
- * adjusts the alarm minute to align with the next interval. If the alarm minute exceeds 60,
- * it wraps around to the next hour. The alarm is then set using the calculated minute.
- * Additionally, the alarm, timer, and CLK are enabled, and a log message is printed.
+ * The alarm minute is the next one aligned with the recording interval, from nextAlarmMinute().
+ * The alarm is then set using the calculated minute. Additionally, the alarm, timer, and CLK are
+ * enabled, and a log message is printed.
  */
 void setupNextAlarm() {
 	RTC_Date currentTime = rtc.getDateTime();
 
-	uint8_t alarmMinute = currentTime.minute;
-
-	if (currentTime.minute % recordingIntervalMins != 0) {
-		// The current minute is not aligned with the recording interval
-		// Calculate the adjustment needed to align with the next interval
-		alarmMinute += recordingIntervalMins - (currentTime.minute % recordingIntervalMins);
-	} else {
-		// The current minute is already aligned with the recording interval
-		// Increment alarmMinute by the recording interval
-		alarmMinute += recordingIntervalMins;
-	}
-
-	if (alarmMinute >= 60) {
-		// Set alarmMinute to 0 to wrap around to the next hour
-		alarmMinute = 0;
-	}
+	uint8_t alarmMinute = nextAlarmMinute(currentTime.minute, recordingIntervalMins);
 
 	rtc.setAlarmByMinutes(alarmMinute);
 	rtc.enableAlarm();
@@ -209,6 +688,20 @@ void getSerialNumber() {
 	sprintf(serialNumber, "%02X", mac[5]);
 }
 
+/**
+ * @brief Gets the unit ID, the whole MAC address as 12 hex characters.
+ *
+ * The serial number in the file name is only the last byte, so units can share it. The unit
+ * ID is written at the top of every log file so logs from a fleet can be told apart.
+ */
+const char* getUnitId() {
+	static char unitId[13];
+	uint8_t mac[6];
+	WiFi.macAddress(mac);
+	snprintf(unitId, sizeof(unitId), "%02X%02X%02X%02X%02X%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+	return unitId;
+}
+
 /**
  * @brief Generates a filename based on the current timestamp and MAC address.
  * @return The generated filename as a null-terminated string.
@@ -220,13 +713,20 @@ void generateFilename() {
 	// Build the filename with leading forward slash
 	snprintf(logFilePath, sizeof(logFilePath), "/%s_%s.csv", getCurrentDateTime("%Y-%b-%e-%H%M"), serialNumber);  // Format: /2023-Jun-23-2041_C8.csv
 
+	takeSPIBus();
+	acquirePowerLock(sdFlushLock);
+
 	File file = SD.open(logFilePath, FILE_WRITE, true);
 	if (!file) {
 		ESP_LOGW("generateFilename", "Failed to open file");
+		releasePowerLock(sdFlushLock);
+		giveSPIBus();
 		return;
 	}
 
-	char header[128] = "Date(YYYY-MM-DD),Time(HH:MM),Battery(mV)";
+	// The offset keeps rows apart when the clocks go back, and a sensor's whole ROM code tells it apart from any other
+	char header[64 + oneWirePortCount * maxSensorsPerPort * 18];
+	strcpy(header, LOG_HEADER_FIXED_COLUMNS);
 
 	// Iterate over each temperature sensor bus
 	for (uint8_t portIndex = 0; portIndex < oneWirePortCount; portIndex++) {
@@ -234,94 +734,394 @@ void generateFilename() {
 			// Iterate over each sensor on the current bus
 			for (uint8_t sensorIndex = 0; sensorIndex < oneWirePort[portIndex].numberOfSensors; sensorIndex++) {
 				// Convert the address to text
-				char tempStr[8];
-				snprintf(tempStr, sizeof(tempStr), ",%s", deviceAddressTo4Char(oneWirePort[portIndex].sensorList[sensorIndex].address));
+				char tempStr[20];
+				snprintf(tempStr, sizeof(tempStr), ",%s", deviceAddressToHex(oneWirePort[portIndex].sensorList[sensorIndex].address));
 				strcat(header, tempStr);
 			}
 		}
 	}
 
-	file.println(header);
-	ESP_LOGD("", "%s", header);
+	file.printf("Unit ID,%s\r\n", getUnitId());
+	file.println(header);
+	ESP_LOGD("", "%s", header);
+
+	file.close();
+	releasePowerLock(sdFlushLock);
+	giveSPIBus();
+}
+
+/**
+ * @brief Gets the path of the summary file that sits next to the log file.
+ *
+ * @return The path, for example /2023-Jun-23-2041_C8_summary.csv for /2023-Jun-23-2041_C8.csv.
+ */
+const char* getSummaryFilePath() {
+	static char summaryFilePath[sizeof(logFilePath) + 8];
+	const size_t extensionLength = strlen(".csv");
+
+	size_t nameLength = strlen(logFilePath);
+	if (nameLength >= extensionLength) {
+		nameLength -= extensionLength;
+	}
+
+	snprintf(summaryFilePath, sizeof(summaryFilePath), "%.*s_summary.csv", static_cast<int>(nameLength), logFilePath);
+	return summaryFilePath;
+}
+
+/**
+ * @brief Opens the summary file for appending, writing the header if it is new.
+ *
+ * @note The SD card must already be mounted.
+ */
+File openSummaryFile() {
+	File file = SD.open(getSummaryFilePath(), FILE_APPEND, true);
+
+	if (!file) {
+		ESP_LOGW("openSummaryFile", "Failed to open file");
+	} else if (file.size() == 0) {
+		file.println(SUMMARY_HEADER);
+	}
+
+	return file;
+}
+
+/**
+ * @brief Gets the ROM code of every sensor slot, as the log header names it, nullptr for empty slots.
+ */
+const char* const* getSensorNames() {
+	static char names[SUMMARY_SENSOR_COUNT][17];
+	static const char* namePointers[SUMMARY_SENSOR_COUNT];
+
+	for (uint8_t portIndex = 0; portIndex < oneWirePortCount; portIndex++) {
+		for (uint8_t sensorIndex = 0; sensorIndex < maxSensorsPerPort; sensorIndex++) {
+			uint8_t slot = portIndex * maxSensorsPerPort + sensorIndex;
+
+			if (sensorIndex < oneWirePort[portIndex].numberOfSensors) {
+				strcpy(names[slot], deviceAddressToHex(oneWirePort[portIndex].sensorList[sensorIndex].address));
+				namePointers[slot] = names[slot];
+			} else {
+				namePointers[slot] = nullptr;
+			}
+		}
+	}
+
+	return namePointers;
+}
+
+/**
+ * @brief Adds the latest readings to the hourly and daily summaries.
+ *
+ * When an hour or day has ended its finalised rows are appended to the summary file first.
+ * If the file cannot be opened the period stays open and is written on a later sample.
+ *
+ * @param timestamp When the readings were taken.
+ *
+ * @note The SD card must already be mounted.
+ */
+void updatePeriodSummaries(time_t timestamp) {
+	if (!systemTimeValid) {
+		return;
+	}
+
+	uint32_t localSeconds = getLocalSeconds(timestamp);
+
+	if (summaryPeriodsEnded(localSeconds)) {
+		File file = openSummaryFile();
+		if (!file) {
+			return;
+		}
+
+		closeSummaryPeriods(localSeconds, file, getSensorNames());
+		file.close();
+	}
+
+	for (uint8_t portIndex = 0; portIndex < oneWirePortCount; portIndex++) {
+		temperatureSensorBus& bus = oneWirePort[portIndex];
+
+		for (uint8_t sensorIndex = 0; sensorIndex < bus.numberOfSensors; sensorIndex++) {
+			uint8_t slot = portIndex * maxSensorsPerPort + sensorIndex;
+
+			if (bus.sensorList[sensorIndex].error) {
+				addSummaryError(localSeconds, slot);
+			} else {
+				addSummaryReading(localSeconds, slot, bus.sensorList[sensorIndex].temperature);
+			}
+		}
+	}
+}
+
+/**
+ * @brief Writes the partial hour and day to the summary file when recording stops.
+ */
+void flushPeriodSummaries() {
+	takeSPIBus();
+	acquirePowerLock(sdFlushLock);
+
+	File file = openSummaryFile();
+	if (file) {
+		flushSummaryPeriods(file, getSensorNames());
+		file.close();
+	}
+
+	releasePowerLock(sdFlushLock);
+	giveSPIBus();
+}
+
+/**
+ * @brief Waits for the wake button to be released.
+ *
+ * @param timeout The maximum number of ticks to wait.
+ * @return True if the button was released, false if it is still held after the timeout.
+ */
+bool waitForButtonRelease(TickType_t timeout) {
+	TickType_t start = xTaskGetTickCount();
+
+	while (digitalRead(WAKE_BUTTON) == HIGH) {
+		TickType_t elapsed = xTaskGetTickCount() - start;
+		if (elapsed >= timeout) {
+			return false;
+		}
+		xTaskNotifyWait(0, UINT32_MAX, NULL, timeout - elapsed);
+	}
+
+	return true;
+}
+
+/**
+ * @brief Task that monitors the wake button and toggles recording mode.
+ *
+ * This task attaches interrupts to the buttons and sleeps until it is notified of an edge.
+ * Any press restarts the screen timeout. The up and down buttons step through the screen pages.
+ * When the wake button is held for the hold duration, the recording mode is toggled and the rest
+ * of that press is ignored. If recording is enabled, a new log file is started and the next
+ * alarm is set.
+ *
+ * @param parameter Pointer to the task parameters (not used in this implementation).
+ */
+void buttonTask(void* parameter) {
+	attachWakeInterrupt(WAKE_BUTTON, buttonInterrupt);
+	attachWakeInterrupt(UP_BUTTON, upButtonInterrupt);
+	attachWakeInterrupt(DOWN_BUTTON, downButtonInterrupt);
+
+	const uint8_t pageCount = HISTORY_LEVEL_COUNT + 1;
+
+	while (true) {
+		uint32_t edges = 0;
+		xTaskNotifyWait(0, UINT32_MAX, &edges, portMAX_DELAY);
+
+		if ((edges & UP_BUTTON_EDGE) && digitalRead(UP_BUTTON) == HIGH) {
+			xTimerReset(screenTimer, 0);
+			screenPage = (screenPage + 1) % pageCount;
+			xEventGroupSetBits(uiEvents, PAGE_CHANGED_BIT);
+		}
+
+		if ((edges & DOWN_BUTTON_EDGE) && digitalRead(DOWN_BUTTON) == HIGH) {
+			xTimerReset(screenTimer, 0);
+			screenPage = (screenPage + pageCount - 1) % pageCount;
+			xEventGroupSetBits(uiEvents, PAGE_CHANGED_BIT);
+		}
+
+		if ((edges & WAKE_BUTTON_EDGE) && digitalRead(WAKE_BUTTON) == HIGH) {
+			xTimerReset(screenTimer, 0);
+
+			if (!waitForButtonRelease(pdMS_TO_TICKS(HOLD_DURATION))) {
+				if (recording) {
+					recording = false;
+					flushPeriodSummaries();
+				} else {
+					recording = true;
+					generateFilename();
+					clearSummaryPeriods();
+					clearWakeStubSamples();
+					ESP_LOGI("Started New File", "%s", logFilePath);
+
+					setupNextAlarm();
+				}
+
+				// Ignore the rest of this press so a long hold only toggles once
+				waitForButtonRelease(portMAX_DELAY);
+			}
+		}
+	}
+}
+
+/**
+ * @brief Enters deep sleep mode based on battery voltage and recording status.
+ *
+ * If the battery voltage is above 3300 millivolts and recording is enabled, the function
+ * enables deep sleep mode with RTC wakeup. Otherwise, it enables deep sleep mode with
+ * wakeup triggered by user input. After setting up the wakeup mode, the function starts
+ * the deep sleep process.
+ *
+ * While recording, the sensors start converting before sleep and the wake stub is armed, so
+ * the next RTC alarms are logged without a full boot until its buffer fills.
+ */
+void enterDeepSleep() {
+	if ((batteryMilliVolts > 3300) && recording) {
+		// Hand the sensors to the wake stub with a conversion ready for it to read
+		wakeStubPort stubPorts[WAKE_STUB_PORT_COUNT] = {};
+
+		// The UI mode sensor task holds the sensors for each whole bus transaction, so taking them
+		// waits for one in progress to finish. They are never given back, so it cannot start
+		// another before sleep.
+		takeSensors();
+		acquirePowerLock(oneWireLock);
+		for (uint8_t portIndex = 0; portIndex < oneWirePortCount; portIndex++) {
+			temperatureSensorBus& bus = oneWirePort[portIndex];
+
+			stubPorts[portIndex].pin = bus.oneWirePin;
+			stubPorts[portIndex].sensorCount = bus.numberOfSensors;
+			for (uint8_t sensorIndex = 0; sensorIndex < bus.numberOfSensors; sensorIndex++) {
+				memcpy(stubPorts[portIndex].addresses[sensorIndex], bus.sensorList[sensorIndex].address, sizeof(DeviceAddress));
+			}
+
+			if (bus.numberOfSensors > 0) {
+				bus.oneWireBus.begin(bus.oneWirePin);
+				bus.dallasTemperatureBus.setWaitForConversion(false);
+				bus.dallasTemperatureBus.requestTemperatures();
+			}
+		}
+		releasePowerLock(oneWireLock);
+
+		armWakeStub(stubPorts, WIRE_RTC_INT, recordingIntervalMins);
+
+		// Enable deep sleep mode with RTC wakeup
+		esp_sleep_enable_ext1_wakeup(RTC_DEEPSLEEP_INTERUPT_BITMASK, ESP_EXT1_WAKEUP_ANY_HIGH);
+		ESP_LOGV("Enter DeepSleep", "Waiting For RTC or user input");
+	} else {
+		disarmWakeStub();
+
+		// Enable deep sleep mode with wakeup triggered by user input
+		esp_sleep_enable_ext1_wakeup(DEEPSLEEP_INTERUPT_BITMASK, ESP_EXT1_WAKEUP_ANY_HIGH);
+		ESP_LOGI("Enter DeepSleep", "Waiting for user input");
+	}
+
+	// Start the deep sleep process
+	esp_deep_sleep_start();
+
+	// code here will never be run...
+}
+
+/**
+ * @brief Sends the log lines the collector does not have yet while Wi-Fi is up.
+ *
+ * @return What was sent, all zero if offloading is disabled or the log could not be read.
+ */
+offloadReport offloadNewLogLines() {
+	offloadReport report = {};
+
+	if (strlen(OFFLOAD_URL) == 0 || logFilePath[0] == '\0') {
+		return report;
+	}
+
+	takeSPIBus();
+	configurePin(SPI_EN, OUTPUT, HIGH);
+	acquirePowerLock(sdFlushLock);
+
+	File file;
+	if (mountSDCard(SD_CARD_CS, SPI, false)) {
+		file = SD.open(logFilePath, FILE_READ);
+		if (!file) {
+			ESP_LOGW("Offload", "Failed to open %s", logFilePath);
+		}
+	}
+	giveSPIBus();
+
+	// offloadLogFile only holds the bus while it reads each batch
+	if (file) {
+		report = offloadLogFile(file, logFilePath, OFFLOAD_URL, getUnitId());
 
-	file.close();
+		takeSPIBus();
+		file.close();
+		giveSPIBus();
+	}
+
+	releasePowerLock(sdFlushLock);
+	return report;
 }
 
 /**
- * @brief Task that monitors the wake button and toggles recording mode.
+ * @brief Logs what an offload sent and how much it sent per joule of radio time.
  *
- * This task initializes the wake button pin, attaches an interrupt to detect rising edges,
- * and monitors the button state to toggle the recording mode. When the button is pressed
- * and held for a certain duration, the recording mode is toggled. If recording is enabled,
- * the next alarm is set. The task periodically checks the button state using a semaphore
- * and waits for interrupts to occur.
- *
- * @param parameter Pointer to the task parameters (not used in this implementation).
+ * @param offloaded What was sent.
+ * @param radioOnAt When Wi-Fi was turned on, from millis().
  */
-void buttonTask(void* parameter) {
-	// Initialize wake button pin and attach interrupt
-	pinMode(WAKE_BUTTON, INPUT);
-	attachInterrupt(digitalPinToInterrupt(WAKE_BUTTON), buttonInterrupt, RISING);
+void logOffloadReport(const offloadReport& offloaded, uint32_t radioOnAt) {
+	if (offloaded.batchesSent > 0) {
+		uint32_t radioOnMs = millis() - radioOnAt;
+		ESP_LOGI("Offload", "%u bytes in %u batches (%u ms), %s, radio on %u ms, %.0f bytes/J", offloaded.bytesSent, offloaded.batchesSent,
+				 offloaded.sendMs, offloaded.complete ? "complete" : "more to send", radioOnMs,
+				 offloadBytesPerJoule(offloaded.bytesSent, radioOnMs, batteryMilliVolts));
+	}
+}
 
-	buttonSemaphore = xSemaphoreCreateBinary();
+/**
+ * @brief Checks whether the collector is missing any of the log file.
+ */
+bool logFileHasUnsentLines() {
+	bool pending = false;
 
-	TickType_t lastWakeTime = xTaskGetTickCount();
+	takeSPIBus();
+	configurePin(SPI_EN, OUTPUT, HIGH);
+	acquirePowerLock(sdFlushLock);
 
-	while (true) {
-		if (xSemaphoreTake(buttonSemaphore, portMAX_DELAY) == pdTRUE) {
-			if (digitalRead(WAKE_BUTTON) == HIGH) {
-				vTaskDelay(pdMS_TO_TICKS(HOLD_DURATION));  // Delay for the hold duration
-
-				if (digitalRead(WAKE_BUTTON) == HIGH) {
-					if (recording) {
-						recording = false;
-						vTaskDelay(10000 / portTICK_PERIOD_MS);
-					} else {
-						recording = true;
-						generateFilename();
-						ESP_LOGI("Started New File", "%s", logFilePath);
-
-						setupNextAlarm();
-						vTaskDelay(10000 / portTICK_PERIOD_MS);
-					}
-				}
-			} 
+	if (mountSDCard(SD_CARD_CS, SPI, false)) {
+		File file = SD.open(logFilePath, FILE_READ);
+		if (file) {
+			pending = offloadPending(logFilePath, file.size());
+			file.close();
 		}
-
-		vTaskDelayUntil(&lastWakeTime, pdMS_TO_TICKS(10));	// Check every 10 milliseconds for interrupt semaphore
 	}
+
+	releasePowerLock(sdFlushLock);
+	giveSPIBus();
+	return pending;
 }
 
 /**
- * @brief Enters deep sleep mode based on battery voltage and recording status.
+ * @brief Opens a Wi-Fi window to offload the log when one is due and the collector is missing some of it.
  *
- * If the battery voltage is above 3300 millivolts and recording is enabled, the function
- * enables deep sleep mode with RTC wakeup. Otherwise, it enables deep sleep mode with
- * wakeup triggered by user input. After setting up the wakeup mode, the function starts
- * the deep sleep process.
+ * Windows are OFFLOAD_INTERVAL_S apart. Joining the network is given OFFLOAD_CONNECT_TIMEOUT_MS
+ * and sending OFFLOAD_TIME_BUDGET_MS, so an unreachable network or collector costs at most
+ * their sum once per interval.
  */
-void enterDeepSleep() {
-	if ((batteryMilliVolts > 3300) && recording) {
-		// Enable deep sleep mode with RTC wakeup
-		esp_sleep_enable_ext1_wakeup(RTC_DEEPSLEEP_INTERUPT_BITMASK, ESP_EXT1_WAKEUP_ANY_HIGH);
-		ESP_LOGV("Enter DeepSleep", "Waiting For RTC or user input");
-	} else {
-		// Enable deep sleep mode with wakeup triggered by user input
-		esp_sleep_enable_ext1_wakeup(DEEPSLEEP_INTERUPT_BITMASK, ESP_EXT1_WAKEUP_ANY_HIGH);
-		ESP_LOGI("Enter DeepSleep", "Waiting for user input");
+void offloadIfDue() {
+	if (strlen(OFFLOAD_URL) == 0 || logFilePath[0] == '\0' || !recording || !systemTimeValid) {
+		return;
 	}
 
-	// Start the deep sleep process
-	esp_deep_sleep_start();
+	time_t now = time(nullptr);
+	if (!offloadWindowDue(now) || !logFileHasUnsentLines()) {
+		return;
+	}
+	openOffloadWindow(now);
 
-	// code here will never be run...
+	acquirePowerLock(wifiSyncLock);
+	uint32_t radioOnAt = millis();
+	WiFi.begin(WIFI_SSID, WIFI_PW);
+
+	while (WiFi.status() != WL_CONNECTED && millis() - radioOnAt < OFFLOAD_CONNECT_TIMEOUT_MS) {
+		delay(10);
+	}
+
+	offloadReport offloaded = {};
+	if (WiFi.status() == WL_CONNECTED) {
+		offloaded = offloadNewLogLines();
+	} else {
+		ESP_LOGW("Offload", "Wi-Fi did not connect within %u ms", OFFLOAD_CONNECT_TIMEOUT_MS);
+	}
+
+	WiFi.disconnect(true);
+	releasePowerLock(wifiSyncLock);
+	logOffloadReport(offloaded, radioOnAt);
 }
 
 /**
  * @brief Updates the clock based on the current system time or using NTP servers.
  *
  * This function initializes the RTC module and syncs it to the system time if recording is enabled.
- * If recording is disabled or the system time is not valid, the function syncs the RTC using NTP servers.
+ * If recording is disabled or the system time is not valid, the function syncs the RTC using NTP servers,
+ * and while Wi-Fi is up sends any new log lines to the OFFLOAD_URL collector.
  * The function also sets up the next alarm if recording is enabled and the RTC interrupt pin is in the HIGH state.
  */
 void updateClock() {
@@ -365,67 +1165,33 @@ void updateClock() {
 			sntp_setservername(2, ntpServer3);
 			sntp_init();
 
+			acquirePowerLock(wifiSyncLock);
+			uint32_t radioOnAt = millis();
 			WiFi.begin(WIFI_SSID, WIFI_PW);
 
-			// Wait until at least one NTP server is reachable
-			while (!(sntp_getreachability(0) + sntp_getreachability(1) + sntp_getreachability(2) > 0)) {
+			// Wait until at least one NTP server is reachable, or give up until the next boot
+			bool reachable = false;
+			while (!reachable && millis() - radioOnAt < WIFI_SYNC_TIMEOUT_MS) {
+				reachable = sntp_getreachability(0) + sntp_getreachability(1) + sntp_getreachability(2) > 0;
 				delay(10);
 			}
 
-			// Sync RTC to the real-time clock (RTC) of the ESP32
-			rtc.syncToRtc();
-
-			WiFi.disconnect();
-		}
-	}
-}
-
-/**
- * @brief Calculate battery percentage based on voltage using a lookup table.
- *
- * Lookup table for battery voltage in millivolts and corresponding percentage (based on PANASONIC_NCR_18650_B).
- * battery voltage 3300 = 3.3V, state of charge 22 = 22%.
- */
-const uint16_t batteryDischargeCurve[2][12] = {
-	{0, 3300, 3400, 3500, 3600, 3700, 3800, 3900, 4000, 4100, 4200, 9999},
-	{0, 0, 13, 22, 39, 53, 62, 74, 84, 94, 100, 100}};
-
-/**
- * @brief Calculate battery percentage based on voltage.
- *
- * @param batteryMilliVolts The battery voltage in millivolts.
- * @return The battery percentage as a null-terminated char array.
- */
-const char* calculateBatteryPercentage(uint16_t batteryMilliVolts) {
-	static char batteryPercentage[5];  // Static array to hold the battery percentage
-	batteryPercentage[4] = '\0';	   // Null-terminate the array
-
-	// Determine the size of the lookup table
-	uint8_t tableSize = sizeof(batteryDischargeCurve[0]) / sizeof(batteryDischargeCurve[0][0]);
-
-	// Initialize the percentage variable
-	uint8_t percentage = 0;
+			offloadReport offloaded = {};
+			if (reachable) {
+				// Sync RTC to the real-time clock (RTC) of the ESP32
+				rtc.syncToRtc();
 
-	// Iterate through the lookup table to find the two lookup values we are between
-	for (uint8_t index = 0; index < tableSize - 1; index++) {
-		// Check if the battery voltage is within the current range
-		if (batteryMilliVolts <= batteryDischargeCurve[0][index + 1]) {
-			// Get the x and y values for interpolation
-			uint16_t x0 = batteryDischargeCurve[0][index];
-			uint16_t x1 = batteryDischargeCurve[0][index + 1];
-			uint8_t y0 = batteryDischargeCurve[1][index];
-			uint8_t y1 = batteryDischargeCurve[1][index + 1];
+				// Make the most of the radio being on
+				offloaded = offloadNewLogLines();
+			} else {
+				ESP_LOGW("Time", "No NTP server reachable within %u ms", WIFI_SYNC_TIMEOUT_MS);
+			}
 
-			// Perform linear interpolation to calculate the battery percentage
-			percentage = static_cast<uint8_t>(y0 + ((y1 - y0) * (batteryMilliVolts - x0)) / (x1 - x0));
-			break;
+			WiFi.disconnect(true);
+			releasePowerLock(wifiSyncLock);
+			logOffloadReport(offloaded, radioOnAt);
 		}
 	}
-
-	// Convert the percentage to a char array
-	snprintf(batteryPercentage, sizeof(batteryPercentage), "%u%%", percentage);
-
-	return batteryPercentage;
 }
 
 /**
@@ -477,7 +1243,6 @@ void populateSDCardInfo(sdCard& cardInfo) {
  * - Initializes the SD card.
  * - Opens the log file in append mode.
  * - Checks if the file is empty and writes the header if needed.
- * - Retrieves the current timestamp.
  * - Formats the data line with timestamp, battery voltage, and temperature readings.
  * - Writes the data line to the log file.
  * - Closes the file.
@@ -489,64 +1254,138 @@ void populateSDCardInfo(sdCard& cardInfo) {
  *
  * @note Make sure to initialize the SD card library before calling this function.
  *
+ * @param timestamp When the readings were taken.
+ * @return True if the line was written.
  */
-void writeLineToSDcard() {
+bool writeLineToSDcard(time_t timestamp) {
+	takeSPIBus();
+
 	// Configure pins
 	configurePin(SPI_EN, OUTPUT, HIGH);
 	configurePin(TFT_CS, OUTPUT, HIGH);
 	configurePin(SD_CARD_CS, OUTPUT, HIGH);
 
+	acquirePowerLock(sdFlushLock);
+
 	// Initialize SD card
-	if (SD.begin(SD_CARD_CS)) {
+	if (mountSDCard(SD_CARD_CS, SPI, false)) {
 		ESP_LOGI("SD Card", "Connected");
 
 		// Open file in append mode
 		File file = SD.open(logFilePath, FILE_APPEND, true);
 		if (!file) {
 			ESP_LOGW("writeLineToSDcard", "Failed to open file");
-			return;
+			releasePowerLock(sdFlushLock);
+			giveSPIBus();
+			return false;
 		}
 
-		// Create a buffer to store the data line
-		char dataLine[128];
-
-		// Format the data line with current date and time, and battery voltage
-		snprintf(dataLine, sizeof(dataLine), "%s,%u", getCurrentDateTime("%Y-%m-%d,%H:%M"), batteryMilliVolts);
+		// Gather the readings of each sensor on each bus
+		logReading readings[oneWirePortCount * maxSensorsPerPort];
+		uint8_t readingCount = 0;
 
-		// Iterate through each temperature sensor bus
 		for (uint8_t portIndex = 0; portIndex < oneWirePortCount; portIndex++) {
 			temperatureSensorBus& bus = oneWirePort[portIndex];
 
-			// Check if the current bus has sensors
-			if (bus.numberOfSensors > 0) {
-				// Iterate through each sensor on the current bus
-				for (uint8_t sensorIndex = 0; sensorIndex < bus.numberOfSensors; sensorIndex++) {
-					char tempStr[8];
-
-					// Check if the current sensor has an error
-					if (bus.sensorList[sensorIndex].error) {
-						strcpy(tempStr, ",ERR");
-					} else {
-						// Get the temperature reading from ram
-						float temperature = bus.sensorList[sensorIndex].temperature;
-						snprintf(tempStr, sizeof(tempStr), ",%.1f", temperature);
-					}
-
-					// Append the temperature reading to the data line
-					strcat(dataLine, tempStr);
-				}
+			for (uint8_t sensorIndex = 0; sensorIndex < bus.numberOfSensors; sensorIndex++) {
+				readings[readingCount++] = {bus.sensorList[sensorIndex].temperature, bus.sensorList[sensorIndex].error};
 			}
 		}
 
-		// Write the data line to the csv file
-		file.println(dataLine);
+		// Create a buffer to store the data line, with room for every sensor and the line ending
+		char dataLine[64 + oneWirePortCount * maxSensorsPerPort * 8];
+		size_t length = formatLogLine(dataLine, sizeof(dataLine) - 2, formatDateTime(timestamp, LOG_DATE_TIME_FORMAT), batteryMilliVolts, readings, readingCount);
+
+		// Write the data line to the csv file in one call
+		memcpy(dataLine + length, "\r\n", 3);
+		file.write(reinterpret_cast<const uint8_t*>(dataLine), length + 2);
 		file.close();
 
-		// Log the data line
+		// Log the data line without the line ending
+		dataLine[length] = '\0';
 		ESP_LOGD("", "%s", dataLine);
 
-	} else {
-		ESP_LOGW("No SD Card", "");
+		updatePeriodSummaries(timestamp);
+
+		releasePowerLock(sdFlushLock);
+		giveSPIBus();
+		return true;
+	}
+
+	ESP_LOGW("No SD Card", "");
+	releasePowerLock(sdFlushLock);
+	giveSPIBus();
+	return false;
+}
+
+/**
+ * @brief Draws a sensor's temperature history as a sparkline, oldest bucket on the left.
+ *
+ * Each bucket is drawn as a grey bar from its minimum to its maximum, with the means joined by
+ * a white line. The vertical scale fits the sensor's own range, but is at least 1 degree.
+ *
+ * @param level The history level to draw.
+ * @param sensor The sensor slot, port index * maxSensorsPerPort + sensor index.
+ */
+void drawSparkline(uint8_t level, uint8_t sensor, int x, int y, int width, int height) {
+	float minimum[HISTORY_BUCKET_COUNT + 1];
+	float average[HISTORY_BUCKET_COUNT + 1];
+	float maximum[HISTORY_BUCKET_COUNT + 1];
+	bool hasData[HISTORY_BUCKET_COUNT + 1];
+	float low = INFINITY;
+	float high = -INFINITY;
+
+	for (uint8_t age = 0; age <= HISTORY_BUCKET_COUNT; age++) {
+		hasData[age] = getHistoryBucket(level, sensor, age, minimum[age], average[age], maximum[age]);
+		if (hasData[age]) {
+			low = min(low, minimum[age]);
+			high = max(high, maximum[age]);
+		}
+	}
+
+	screen.fillRect(x, y, width, height, TFT_BLACK);
+
+	if (low > high) {
+		screen.setTextColor(TFT_DARKGREY, TFT_BLACK, true);
+		screen.drawString("No data", x, y, 2);
+		screen.setTextColor(TFT_WHITE, TFT_BLACK, true);
+		return;
+	}
+
+	if (high - low < 1.0f) {
+		float centre = (high + low) / 2;
+		low = centre - 0.5f;
+		high = centre + 0.5f;
+	}
+
+	auto temperatureToY = [&](float temperature) {
+		return y + height - 1 - static_cast<int>((temperature - low) / (high - low) * (height - 1));
+	};
+
+	const int step = width / (HISTORY_BUCKET_COUNT + 1);
+	int lastX = -1;
+	int lastY = 0;
+
+	for (int age = HISTORY_BUCKET_COUNT; age >= 0; age--) {
+		int pointX = x + (HISTORY_BUCKET_COUNT - age) * step + step / 2;
+
+		if (!hasData[age]) {
+			lastX = -1;
+			continue;
+		}
+
+		int topY = temperatureToY(maximum[age]);
+		screen.drawFastVLine(pointX, topY, temperatureToY(minimum[age]) - topY + 1, TFT_DARKGREY);
+
+		int pointY = temperatureToY(average[age]);
+		if (lastX >= 0) {
+			screen.drawLine(lastX, lastY, pointX, pointY, TFT_WHITE);
+		} else {
+			screen.drawPixel(pointX, pointY, TFT_WHITE);
+		}
+
+		lastX = pointX;
+		lastY = pointY;
 	}
 }
 
@@ -555,14 +1394,21 @@ void writeLineToSDcard() {
  *
  * This function updates the UI display to reflect the current state of the system. It includes
  * updating the REC symbol if the system is in recording mode, displaying battery percentage,
- * temperature values for sensors, SD card information, and the current date and time.
+ * temperature values (or history sparklines) for sensors, SD card information, and the current
+ * date and time.
  * The function utilizes specific positions and colors to ensure consistent and organized
  * presentation of the information on the screen.
  */
 void updateScreen() {
-	if (sensorsChanged) {
+	static uint8_t drawnPage = 0;
+
+	takeSPIBus();
+	acquirePowerLock(displayLock);
+
+	if (sensorsChanged || screenPage != drawnPage) {
 		screen.fillScreen(TFT_BLACK);
 		sensorsChanged = false;
+		drawnPage = screenPage;
 	}
 
 	// Define positions for REC symbol
@@ -607,6 +1453,10 @@ void updateScreen() {
 	const int DEVICE_ADDRESS_X = 12;
 	const int TEMPERATURE_X = DEVICE_ADDRESS_X + (4 * 20);
 	const int DEGREE_SYMBOL_X = TEMPERATURE_X + 50;
+	const int SPARKLINE_WIDTH = 76;
+	const int SPARKLINE_HEIGHT = 20;
+	const int HISTORY_TITLE_X = 8;
+	const int HISTORY_TITLE_Y = 268;
 
 	// Set text color and background color for battery percentage and temperature values
 	screen.setTextColor(TFT_WHITE, TFT_BLACK, true);
@@ -626,8 +1476,13 @@ void updateScreen() {
 
 			for (uint8_t sensorIndex = 0; sensorIndex < numberOfSensors; sensorIndex++) {
 				screen.drawString(deviceAddressTo4Char(oneWirePort[portIndex].sensorList[sensorIndex].address), DEVICE_ADDRESS_X, yPosition, 4);
-				screen.drawFloat(oneWirePort[portIndex].sensorList[sensorIndex].temperature, 1, TEMPERATURE_X, yPosition, 4);
-				screen.drawString("`C", DEGREE_SYMBOL_X, yPosition, 4);
+
+				if (screenPage == 0) {
+					screen.drawFloat(oneWirePort[portIndex].sensorList[sensorIndex].temperature, 1, TEMPERATURE_X, yPosition, 4);
+					screen.drawString("`C", DEGREE_SYMBOL_X, yPosition, 4);
+				} else {
+					drawSparkline(screenPage - 1, portIndex * maxSensorsPerPort + sensorIndex, TEMPERATURE_X, yPosition, SPARKLINE_WIDTH, SPARKLINE_HEIGHT);
+				}
 
 				yPosition += COLOR_BAR_SPACING;
 			}
@@ -645,6 +1500,11 @@ void updateScreen() {
 	// Set text color and background color for SD card information
 	screen.setTextColor(TFT_DARKGREY, TFT_BLACK, true);
 
+	// Draw the history level name
+	if (screenPage != 0) {
+		screen.drawString(historyLevelNames[screenPage - 1], HISTORY_TITLE_X, HISTORY_TITLE_Y, 2);
+	}
+
 	// Draw SD card and unit id information
 	screen.setCursor(SD_CARD_INFO_X, SD_CARD_INFO_Y, 2);
 	if (microSDCard.connected) {
@@ -655,15 +1515,164 @@ void updateScreen() {
 
 	// Draw current date and time
 	screen.drawString(getCurrentDateTime("%e %b %Y %H:%M"), DATE_TIME_X, DATE_TIME_Y, 2);
+
+	releasePowerLock(displayLock);
+	giveSPIBus();
+}
+
+/**
+ * @brief Adds the latest temperature readings to the history shown on the trend pages.
+ *
+ * @param timestamp When the readings were taken.
+ */
+void recordHistorySample(time_t timestamp) {
+	if (!systemTimeValid) {
+		return;
+	}
+
+	advanceHistory(getLocalSeconds(timestamp));
+
+	for (uint8_t portIndex = 0; portIndex < oneWirePortCount; portIndex++) {
+		temperatureSensorBus& bus = oneWirePort[portIndex];
+
+		for (uint8_t sensorIndex = 0; sensorIndex < bus.numberOfSensors; sensorIndex++) {
+			if (!bus.sensorList[sensorIndex].error) {
+				addHistoryReading(portIndex * maxSensorsPerPort + sensorIndex, bus.sensorList[sensorIndex].temperature);
+			}
+		}
+	}
+}
+
+/**
+ * @brief Applies exponential smoothing to a new reading, starting afresh after an error.
+ */
+void updateSensorReading(temperatureSensor& sensor, float currentTemperature) {
+	if (sensor.error) {
+		sensor.temperature = currentTemperature;
+	} else {
+		sensor.temperature = (temperatureSmoothingFactor * currentTemperature) + ((1 - temperatureSmoothingFactor) * sensor.temperature);
+	}
+
+	sensor.error = false;
+}
+
+/**
+ * @brief Logs the samples the wake stub took while the rest of the firmware slept, oldest first.
+ *
+ * Each sample is smoothed, written and added to the history as if a full boot had read it. The
+ * stub cannot read the battery, so the lines carry the last voltage measured. If a line cannot
+ * be written, that sample and the ones after it stay buffered for the next flush.
+ *
+ * The sensors are held for the whole flush. In UI mode the sensor task's readings are newer
+ * than any stub sample, so they are put back afterwards rather than smoothed with older ones.
+ */
+void flushWakeStubSamples() {
+	uint8_t sampleCount = getWakeStubSampleCount();
+	if (sampleCount == 0 || !systemTimeValid) {
+		return;
+	}
+
+	takeSPIBus();
+	takeSensors();
+
+	bool keepLiveReadings = uiEvents != nullptr;  // Only created in UI mode
+	temperatureSensor liveReadings[oneWirePortCount][maxSensorsPerPort];
+	for (uint8_t portIndex = 0; portIndex < oneWirePortCount; portIndex++) {
+		memcpy(liveReadings[portIndex], oneWirePort[portIndex].sensorList, sizeof(liveReadings[portIndex]));
+	}
+
+	uint8_t written = 0;
+	wakeStubSample sample;
+	while (written < sampleCount) {
+		getWakeStubSample(written, sample);
+
+		for (uint8_t portIndex = 0; portIndex < oneWirePortCount; portIndex++) {
+			temperatureSensorBus& bus = oneWirePort[portIndex];
+
+			for (uint8_t sensorIndex = 0; sensorIndex < bus.numberOfSensors; sensorIndex++) {
+				updateSensorReading(bus.sensorList[sensorIndex], sample.temperatures[portIndex * maxSensorsPerPort + sensorIndex]);
+			}
+		}
+
+		// The PCF8563 keeps UTC, so the stub's date and time are already seconds since 1970
+		time_t timestamp = dateTimeToSeconds(sample.year, sample.month, sample.day, sample.hour, sample.minute, 0);
+
+		if (!writeLineToSDcard(timestamp)) {
+			break;
+		}
+		recordHistorySample(timestamp);
+		written++;
+	}
+
+	if (keepLiveReadings) {
+		for (uint8_t portIndex = 0; portIndex < oneWirePortCount; portIndex++) {
+			memcpy(oneWirePort[portIndex].sensorList, liveReadings[portIndex], sizeof(liveReadings[portIndex]));
+		}
+	}
+
+	giveSensors();
+	giveSPIBus();
+
+	// Drop what was written even if a later line failed, so a retry does not log it twice
+	dropWakeStubSamples(written);
+	ESP_LOGI("Wake Stub", "Logged %u of %u samples", written, sampleCount);
+}
+
+#if USB_VIRTUAL_VOLUME
+/**
+ * @brief Rebuilds the virtual USB volume from the files on the SD card.
+ *
+ * The log and summary files being recorded are placed last so they can grow without moving
+ * the other files.
+ */
+void updateVirtualVolume() {
+	const char* growingFiles[] = {logFilePath + 1, getSummaryFilePath() + 1};  // Without the leading slash
+
+	takeSPIBus();
+	acquirePowerLock(sdFlushLock);
+
+	if (!buildVirtualVolume(readCardSector, SD.numSectors(), growingFiles, recording ? 2 : 0)) {
+		ESP_LOGW("Virtual Volume", "SD card file system not supported");
+	}
+	ESP_LOGI("Virtual Volume", "%u files", getVirtualFileCount());
+
+	releasePowerLock(sdFlushLock);
+	giveSPIBus();
+}
+
+/**
+ * @brief Writes a log line when the RTC alarm fires while awake, then shows it on the virtual volume.
+ */
+void logWhileAwake() {
+	if (recording) {
+		time_t timestamp = time(nullptr);
+
+		// Log the readings as one set, without the sensor task updating them part way
+		takeSPIBus();
+		takeSensors();
+		flushWakeStubSamples();
+		writeLineToSDcard(timestamp);
+		recordHistorySample(timestamp);
+		giveSensors();
+		giveSPIBus();
+
+		updateVirtualVolume();
+		setupNextAlarm();
+	} else {
+		clearAlarm();
+	}
 }
+#endif
 
 /**
- * @brief Task that manages SPI communication and updates the screen periodically.
+ * @brief Task that manages SPI communication and updates the screen.
  *
- * This task handles the SPI communication and updates the screen periodically. It configures
- * the necessary pins, initializes the screen, sets up the SD card if available, and manages
- * the backlight. It also initializes the USB functionality for data transfer. The task runs
- * in an infinite loop, continuously updating the screen at a regular interval.
+ * This task handles the SPI communication and updates the screen. It configures the necessary
+ * pins, initializes the screen, sets up the SD card if available, and manages the backlight.
+ * It also initializes the USB functionality for data transfer. The task then sleeps until new
+ * sensor readings are ready or the page changes, waking every REC_BLINK_INTERVAL_MS while
+ * recording to blink the REC symbol. With USB_VIRTUAL_VOLUME it also writes the log line when
+ * the RTC alarm fires, since this task owns the SPI bus.
  *
  * @param parameter Task parameter (not used in this implementation).
  */
@@ -674,32 +1683,52 @@ void SPIManagerTask(void* parameter) {
 	configurePin(SD_CARD_CS, OUTPUT, HIGH);
 
 	// Initialize screen
+	takeSPIBus();
+	acquirePowerLock(displayLock);
 	screen.init();
 	screen.setRotation(2);
 	screen.fillScreen(TFT_BLACK);
+	releasePowerLock(displayLock);
+	giveSPIBus();
 	updateScreen();
 
-	// Fade in the backlight gradually
-	pinMode(BACKLIGHT, OUTPUT);
-	for (uint8_t brightness = 0; brightness < 255; brightness++) {
-		analogWrite(BACKLIGHT, brightness);
-		vTaskDelay(5 / portTICK_PERIOD_MS);
-	}
+	fadeBacklight(true);
 
-	// Initialize SD card
-	if (SD.begin(SD_CARD_CS, screen.getSPIinstance(), SPI_FREQUENCY)) {
+	// Initialize SD card, finding its fastest clock the first time it is seen
+	takeSPIBus();
+	acquirePowerLock(sdFlushLock);
+	bool sdMounted = mountSDCard(SD_CARD_CS, screen.getSPIinstance(), true);
+	releasePowerLock(sdFlushLock);
+
+	if (sdMounted) {
 		microSDCard.connected = true;
+		acquirePowerLock(sdFlushLock);
 		populateSDCardInfo(microSDCard);
+		releasePowerLock(sdFlushLock);
+
+		// Log what the wake stub recorded before the computer can see the card
+		if (recording) {
+			flushWakeStubSamples();
+		}
 
 		// Initialize USB
 		MSC.vendorID("Kea");		 // max 8 chars
 		MSC.productID("Recorder");	 // max 16 chars
 		MSC.productRevision("020");	 // max 4 chars
 		MSC.onStartStop(onStartStop);
+#if USB_VIRTUAL_VOLUME
+		updateVirtualVolume();
+		MSC.onRead(onVirtualRead);
+		MSC.onWrite(onVirtualWrite);
+		MSC.mediaPresent(true);
+		MSC.begin(getVirtualSectorCount(), VIRTUAL_SECTOR_SIZE);  // Can be larger than a small card
+#else
 		MSC.onRead(onRead);
 		MSC.onWrite(onWrite);
 		MSC.mediaPresent(true);
 		MSC.begin(SD.numSectors(), SD.cardSize() / SD.numSectors());
+#endif
+		USBSerial.onEvent(ARDUINO_USB_CDC_RX_EVENT, onUSBSerialEvent);
 		USBSerial.begin();
 		USB.begin();
 
@@ -707,11 +1736,22 @@ void SPIManagerTask(void* parameter) {
 		ESP_LOGW("No SD Card", "");
 		microSDCard.connected = false;
 	}
+	giveSPIBus();
 
 	while (true) {
-		// Update the screen periodically
+		// Update the screen when new readings arrive, or periodically to blink the REC symbol
+		TickType_t timeout = recording ? pdMS_TO_TICKS(REC_BLINK_INTERVAL_MS) : portMAX_DELAY;
+#if USB_VIRTUAL_VOLUME
+		EventBits_t events = xEventGroupWaitBits(uiEvents, SAMPLE_READY_BIT | PAGE_CHANGED_BIT | LOG_DUE_BIT, pdTRUE, pdFALSE, timeout);
+
+		if ((events & LOG_DUE_BIT) && microSDCard.connected) {
+			logWhileAwake();
+		}
+#else
+		xEventGroupWaitBits(uiEvents, SAMPLE_READY_BIT | PAGE_CHANGED_BIT, pdTRUE, pdFALSE, timeout);
+#endif
+
 		updateScreen();
-		vTaskDelay(500 / portTICK_PERIOD_MS);
 	}
 
 	// This line will never be reached as the task runs in an infinite loop
@@ -729,6 +1769,9 @@ void SPIManagerTask(void* parameter) {
 void scanOneWireBusses() {
 	DeviceAddress tempAddress;	// Variable to store a found device address
 
+	takeSensors();
+	acquirePowerLock(oneWireLock);
+
 	for (uint8_t portIndex = 0; portIndex < oneWirePortCount; portIndex++) {
 		temperatureSensorBus& bus = oneWirePort[portIndex];
 
@@ -739,9 +1782,17 @@ void scanOneWireBusses() {
 		uint8_t deviceCount = bus.dallasTemperatureBus.getDeviceCount();  // Get the count of devices on the bus
 		// ESP_LOGD("deviceCount", "%u %u", bus.oneWirePin, deviceCount);
 
-		if (deviceCount != bus.numberOfSensors) {
+		// A sensor swapped for another leaves the count the same, so compare the addresses too
+		bool changed = deviceCount != bus.numberOfSensors;
+		for (uint8_t sensorIndex = 0; !changed && sensorIndex < deviceCount; sensorIndex++) {
+			changed = !bus.dallasTemperatureBus.getAddress(tempAddress, sensorIndex) ||
+					  memcmp(tempAddress, bus.sensorList[sensorIndex].address, sizeof(DeviceAddress)) != 0;
+		}
+
+		if (changed) {
 			bus.numberOfSensors = deviceCount;
 			sensorsChanged = true;
+			clearHistory(portIndex * maxSensorsPerPort, maxSensorsPerPort);
 
 			if (bus.numberOfSensors > 0) {
 				// Populate device addresses and set resolution for each sensor
@@ -754,6 +1805,9 @@ void scanOneWireBusses() {
 			}
 		}
 	}
+
+	releasePowerLock(oneWireLock);
+	giveSensors();
 }
 
 /**
@@ -765,6 +1819,9 @@ void scanOneWireBusses() {
  * @note This function assumes that the OneWire buses and DallasTemperature instances are already set up.
  */
 void readOneWireTemperatures() {
+	takeSensors();
+	acquirePowerLock(oneWireLock);
+
 	for (uint8_t portIndex = 0; portIndex < oneWirePortCount; ++portIndex) {
 		temperatureSensorBus& bus = oneWirePort[portIndex];
 
@@ -775,8 +1832,15 @@ void readOneWireTemperatures() {
 		}
 	}
 
+	releasePowerLock(oneWireLock);
+	giveSensors();
+
+	// The CPU may drop to its minimum frequency while the sensors convert
 	vTaskDelay(oneWirePort[0].dallasTemperatureBus.millisToWaitForConversion(ONEWIRE_TEMP_RESOLUTION) / portTICK_PERIOD_MS);
 
+	takeSensors();
+	acquirePowerLock(oneWireLock);
+
 	for (uint8_t portIndex = 0; portIndex < oneWirePortCount; ++portIndex) {
 		temperatureSensorBus& bus = oneWirePort[portIndex];
 
@@ -789,18 +1853,14 @@ void readOneWireTemperatures() {
 				if (currentTemperature == DEVICE_DISCONNECTED_C) {
 					bus.sensorList[sensorIndex].error = true;
 				} else {
-					// Apply exponential smoothing
-					if (bus.sensorList[sensorIndex].error) {
-						bus.sensorList[sensorIndex].temperature = currentTemperature;
-					} else {
-						bus.sensorList[sensorIndex].temperature = (temperatureSmoothingFactor * currentTemperature) + ((1 - temperatureSmoothingFactor) * bus.sensorList[sensorIndex].temperature);
-					}
-
-					bus.sensorList[sensorIndex].error = false;
+					updateSensorReading(bus.sensorList[sensorIndex], currentTemperature);
 				}
 			}
 		}
 	}
+
+	releasePowerLock(oneWireLock);
+	giveSensors();
 }
 
 void printTemperatures() {
@@ -819,8 +1879,27 @@ void printTemperatures() {
 	USBSerial.println("");
 }
 
+void readBatteryVoltage() {
+	// Read the current battery millivolts
+	uint16_t currentMilliVolts = static_cast<uint16_t>(analogReadMilliVolts(VBAT_SENSE) * VBAT_SENSE_SCALE);
+
+	// Exponential smoothing calculation
+	if (batteryMilliVolts == 0) {
+		batteryMilliVolts = currentMilliVolts;
+	} else {
+		batteryMilliVolts = (batterySmoothingFactor * currentMilliVolts + (100 - batterySmoothingFactor) * batteryMilliVolts) / 100;
+	}
+
+	ESP_LOGD("Battery", "%umV", batteryMilliVolts);
+
+	return;
+}
+
 /**
- * @brief Task that periodically reads temperatures from OneWire sensors.
+ * @brief Task that reads temperatures from OneWire sensors every SAMPLE_INTERVAL_MS.
+ *
+ * The battery voltage is read every BATTERY_SAMPLE_INTERVAL samples. After each sample the
+ * SAMPLE_READY_BIT is set so the screen can be redrawn.
  *
  * @param parameter Task parameter (not used in this implementation).
  */
@@ -834,32 +1913,27 @@ void readOneWireTemperaturesTask(void* parameter) {
 	oneWirePort[1].color = TFT_GREEN;
 	oneWirePort[2].color = TFT_BLUE;
 
+	TickType_t lastWakeTime = xTaskGetTickCount();
+	uint8_t samplesSinceBatteryRead = 0;
+
 	while (true) {
 		if (!recording) {
 			scanOneWireBusses();
 			printTemperatures();
 		}
 		readOneWireTemperatures();
-	}
-
-	// This line will never be reached as the task runs in an infinite loop
-	vTaskDelete(NULL);
-}
 
-void readBatteryVoltage() {
-	// Read the current battery millivolts
-	uint16_t currentMilliVolts = static_cast<uint16_t>(analogReadMilliVolts(VBAT_SENSE) * VBAT_SENSE_SCALE);
+		if (++samplesSinceBatteryRead >= BATTERY_SAMPLE_INTERVAL) {
+			readBatteryVoltage();
+			samplesSinceBatteryRead = 0;
+		}
 
-	// Exponential smoothing calculation
-	if (batteryMilliVolts == 0) {
-		batteryMilliVolts = currentMilliVolts;
-	} else {
-		batteryMilliVolts = (batterySmoothingFactor * currentMilliVolts + (100 - batterySmoothingFactor) * batteryMilliVolts) / 100;
+		xEventGroupSetBits(uiEvents, SAMPLE_READY_BIT);
+		vTaskDelayUntil(&lastWakeTime, pdMS_TO_TICKS(SAMPLE_INTERVAL_MS));
 	}
 
-	ESP_LOGD("Battery", "%umV", batteryMilliVolts);
-
-	return;
+	// This line will never be reached as the task runs in an infinite loop
+	vTaskDelete(NULL);
 }
 
 void setup() {
@@ -869,15 +1943,22 @@ void setup() {
 	uint64_t wakeupStatus = esp_sleep_get_ext1_wakeup_status();
 	uint8_t wakeupPin = static_cast<uint8_t>(log2(wakeupStatus));
 
+	createSPIBusLock();
+	createSensorsLock();
+	createPowerLocks();
 	readBatteryVoltage();
 
 	switch (wakeupPin) {
 		case WIRE_RTC_INT:
 			// Low Power Mode
 			ESP_LOGV("Low Power Mode", "");
+			configurePowerManagement(false, false);
 			updateClock();
+			flushWakeStubSamples();
 			readOneWireTemperatures();
-			writeLineToSDcard();
+			writeLineToSDcard(time(nullptr));
+			recordHistorySample(time(nullptr));
+			offloadIfDue();
 			enterDeepSleep();
 			break;
 
@@ -889,33 +1970,51 @@ void setup() {
 			// UI Mode
 			ESP_LOGV("UI Mode", "");
 
-			pinMode(VUSB_SENSE, INPUT);
+			loopTaskHandle = xTaskGetCurrentTaskHandle();
+			uiEvents = xEventGroupCreateStatic(&uiEventsBuffer);
+			screenTimer = xTimerCreateStatic("screenTimer", pdMS_TO_TICKS(SCREEN_ON_TIME * 1000), pdFALSE, NULL, screenTimeoutCallback, &screenTimerBuffer);
+			xTimerStart(screenTimer, 0);
 
-			if (digitalRead(VUSB_SENSE) == HIGH) {
-				// USB Mode
+			attachWakeInterrupt(VUSB_SENSE, usbSenseInterrupt);
+
+			esp_sleep_enable_gpio_wakeup();
+
+			if (!configurePowerManagement(digitalRead(VUSB_SENSE) == HIGH, true) && digitalRead(VUSB_SENSE) == HIGH) {
+				// USB Mode without DFS
 				ESP_LOGV("USB Mode", "");
 				setCpuFrequencyMhz(240);  // Set CPU frequency to boost when needed
 			}
 
 			// Create tasks
-			xTaskCreate(SPIManagerTask, "SPIManagerTask", 100000, NULL, 2, NULL);
-			xTaskCreate(buttonTask, "Button Task", 4000, NULL, 1, NULL);
-			xTaskCreate(readOneWireTemperaturesTask, "readOneWireTemperaturesTask", 10000, NULL, 1, NULL);
+			spiManagerTaskHandle = xTaskCreateStatic(SPIManagerTask, "SPIManagerTask", SPI_MANAGER_TASK_STACK_SIZE, NULL, 2, spiManagerTaskStack, &spiManagerTaskBuffer);
+			buttonTaskHandle = xTaskCreateStatic(buttonTask, "Button Task", BUTTON_TASK_STACK_SIZE, NULL, 1, buttonTaskStack, &buttonTaskBuffer);
+			sensorTaskHandle = xTaskCreateStatic(readOneWireTemperaturesTask, "readOneWireTemperaturesTask", SENSOR_TASK_STACK_SIZE, NULL, 1, sensorTaskStack,
+												 &sensorTaskBuffer);
 
 			updateClock();
 			getSerialNumber();
 
-			while (millis() < (SCREEN_ON_TIME * 1000) || digitalRead(VUSB_SENSE) == HIGH) {
-				vTaskDelay(5000 / portTICK_PERIOD_MS);
-				readBatteryVoltage();
-			}
+#if USB_VIRTUAL_VOLUME
+			// The card is never written by the computer, so keep logging while awake
+			attachWakeInterrupt(WIRE_RTC_INT, rtcAlarmInterrupt);
+#endif
 
-			// Fade out the backlight gradually
-			for (uint8_t brightness = 255; brightness > 0; brightness--) {
-				analogWrite(BACKLIGHT, brightness);
-				vTaskDelay(5 / portTICK_PERIOD_MS);
+			// Stay awake until the screen times out with USB detached
+			while (true) {
+				xEventGroupWaitBits(uiEvents, SCREEN_TIMEOUT_BIT | USB_CHANGED_BIT, pdTRUE, pdFALSE, portMAX_DELAY);
+
+				bool usbAttached = digitalRead(VUSB_SENSE) == HIGH;
+				configurePowerManagement(usbAttached, true);
+
+				if (!usbAttached && !xTimerIsTimerActive(screenTimer)) {
+					break;
+				}
 			}
 
+			configurePowerManagement(false, false);
+			fadeBacklight(false);
+
+			logStackHighWaterMarks();
 			enterDeepSleep();
 			break;
 	}
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <stdint.h>
+
+// Bit-banged OneWire and DS18B20 protocol for code that cannot use the OneWire library, such as
+// the deep sleep wake stub.
+//
+// The bus is a template parameter, so the same protocol drives a GPIO from the wake stub, can be
+// built for a coprocessor program, and is run on a computer against a simulated bus by
+// tools/oneWireProtocolTest.cpp. A bus type provides:
+//
+//   void pullLow();					// Drive the line low
+//   void release();					// Let the pull-up take the line high
+//   bool read();						// Sample the line
+//   void delayMicroseconds(uint32_t);	// Busy wait
+//
+// Define ONEWIRE_PROTOCOL_ATTR before including this header to place the functions in a memory
+// section, for example RTC_IRAM_ATTR for the wake stub.
+
+#ifndef ONEWIRE_PROTOCOL_ATTR
+#define ONEWIRE_PROTOCOL_ATTR
+#endif
+
+constexpr uint8_t ONEWIRE_SEARCH_ROM = 0xF0;
+constexpr uint8_t ONEWIRE_MATCH_ROM = 0x55;
+constexpr uint8_t ONEWIRE_SKIP_ROM = 0xCC;
+constexpr uint8_t DS18B20_CONVERT = 0x44;
+constexpr uint8_t DS18B20_READ_SCRATCHPAD = 0xBE;
+constexpr uint8_t DS18B20_SCRATCHPAD_SIZE = 9;
+constexpr int16_t DS18B20_POWER_ON_RESET = 0x0550;	// 85 degrees, read when no conversion has run
+
+/**
+ * @brief Sends a reset pulse.
+ *
+ * @return True if a device answered with a presence pulse.
+ */
+template <typename Bus>
+ONEWIRE_PROTOCOL_ATTR bool oneWireReset(Bus& bus) {
+	bus.pullLow();
+	bus.delayMicroseconds(480);
+	bus.release();
+	bus.delayMicroseconds(70);
+	bool present = !bus.read();
+	bus.delayMicroseconds(410);
+	return present;
+}
+
+/**
+ * @brief Writes a bit with a standard speed time slot.
+ */
+template <typename Bus>
+ONEWIRE_PROTOCOL_ATTR void oneWireWriteBit(Bus& bus, bool bit) {
+	bus.pullLow();
+	if (bit) {
+		bus.delayMicroseconds(6);
+		bus.release();
+		bus.delayMicroseconds(64);
+	} else {
+		bus.delayMicroseconds(60);
+		bus.release();
+		bus.delayMicroseconds(10);
+	}
+}
+
+/**
+ * @brief Reads a bit with a standard speed time slot.
+ */
+template <typename Bus>
+ONEWIRE_PROTOCOL_ATTR bool oneWireReadBit(Bus& bus) {
+	bus.pullLow();
+	bus.delayMicroseconds(3);
+	bus.release();
+	bus.delayMicroseconds(10);
+	bool bit = bus.read();
+	bus.delayMicroseconds(53);
+	return bit;
+}
+
+/**
+ * @brief Writes a byte, least significant bit first.
+ */
+template <typename Bus>
+ONEWIRE_PROTOCOL_ATTR void oneWireWrite(Bus& bus, uint8_t value) {
+	for (uint8_t bit = 0; bit < 8; bit++) {
+		oneWireWriteBit(bus, value & 1);
+		value >>= 1;
+	}
+}
+
+/**
+ * @brief Reads a byte, least significant bit first.
+ */
+template <typename Bus>
+ONEWIRE_PROTOCOL_ATTR uint8_t oneWireRead(Bus& bus) {
+	uint8_t value = 0;
+
+	for (uint8_t bit = 0; bit < 8; bit++) {
+		value |= oneWireReadBit(bus) << bit;
+	}
+
+	return value;
+}
+
+/**
+ * @brief Calculates the Dallas CRC8 used by ROM codes and scratchpads.
+ *
+ * Bitwise rather than a lookup table, so nothing has to be read from flash.
+ */
+static inline ONEWIRE_PROTOCOL_ATTR uint8_t dallasCrc8(const uint8_t* data, uint8_t length) {
+	uint8_t crc = 0;
+
+	while (length--) {
+		uint8_t value = *data++;
+		for (uint8_t bit = 0; bit < 8; bit++) {
+			bool mix = (crc ^ value) & 1;
+			crc >>= 1;
+			if (mix) {
+				crc ^= 0x8C;
+			}
+			value >>= 1;
+		}
+	}
+
+	return crc;
+}
+
+// Where a ROM search is up to. Zero it to start from the first device.
+struct oneWireSearchState {
+	uint8_t rom[8];			   // The ROM code found last
+	uint8_t lastDiscrepancy;  // Bit, from 1, where the last search took the 0 branch of a fork, 0 for none
+	bool done;				   // Every device has been found
+};
+
+/**
+ * @brief Finds the next device on the bus with the SEARCH ROM command.
+ *
+ * At each bit every device still taking part sends its ROM bit and then its complement, and
+ * the bus keeps the devices that match the bit written back. Where both values are present the
+ * search takes 0 the first time and 1 the next, so calling this until it returns false finds
+ * every device once.
+ *
+ * @param rom Set to the ROM code found.
+ * @return False when every device has been found, no device answered, or the ROM code read
+ *         failed its CRC. After a failure start again with a zeroed state.
+ */
+template <typename Bus>
+ONEWIRE_PROTOCOL_ATTR bool oneWireSearch(Bus& bus, oneWireSearchState& state, uint8_t* rom) {
+	if (state.done || !oneWireReset(bus)) {
+		return false;
+	}
+
+	oneWireWrite(bus, ONEWIRE_SEARCH_ROM);
+	uint8_t lastZeroFork = 0;
+
+	for (uint8_t bitNumber = 1; bitNumber <= 64; bitNumber++) {
+		bool bit = oneWireReadBit(bus);
+		bool complement = oneWireReadBit(bus);
+
+		// Nothing pulled the line low for either value, so no device is left
+		if (bit && complement) {
+			return false;
+		}
+
+		uint8_t& romByte = state.rom[(bitNumber - 1) / 8];
+		uint8_t mask = 1 << ((bitNumber - 1) % 8);
+
+		if (bit == complement) {
+			// A fork: follow the last path up to its last 0 branch, take 1 there and 0 after it
+			bit = bitNumber < state.lastDiscrepancy ? (romByte & mask) != 0 : bitNumber == state.lastDiscrepancy;
+			if (!bit) {
+				lastZeroFork = bitNumber;
+			}
+		}
+
+		romByte = bit ? romByte | mask : romByte & ~mask;
+		oneWireWriteBit(bus, bit);
+	}
+
+	if (dallasCrc8(state.rom, 7) != state.rom[7]) {
+		return false;
+	}
+
+	state.lastDiscrepancy = lastZeroFork;
+	state.done = lastZeroFork == 0;
+	for (uint8_t i = 0; i < 8; i++) {
+		rom[i] = state.rom[i];
+	}
+
+	return true;
+}
+
+/**
+ * @brief Checks a scratchpad and extracts the temperature.
+ *
+ * @param scratchpad The 9 bytes read from the sensor.
+ * @param raw Set to the temperature in 1/16 of a degree.
+ * @return False if the CRC is wrong or no conversion has run since power on.
+ */
+static inline ONEWIRE_PROTOCOL_ATTR bool decodeScratchpad(const uint8_t* scratchpad, int16_t& raw) {
+	// An all-zero scratchpad from a bus held low passes the CRC, but never has the configuration register's fixed bits set
+	if (dallasCrc8(scratchpad, 8) != scratchpad[8] || (scratchpad[4] & 0x9F) != 0x1F) {
+		return false;
+	}
+
+	raw = static_cast<int16_t>(scratchpad[0] | (scratchpad[1] << 8));
+	return raw != DS18B20_POWER_ON_RESET;
+}
+
+/**
+ * @brief Reads the last temperature a sensor converted.
+ *
+ * @param address The sensor's 8 byte ROM code.
+ * @param raw Set to the temperature in 1/16 of a degree.
+ * @return False if the sensor did not answer or the scratchpad was not valid.
+ */
+template <typename Bus>
+ONEWIRE_PROTOCOL_ATTR bool readDS18B20(Bus& bus, const uint8_t* address, int16_t& raw) {
+	uint8_t scratchpad[DS18B20_SCRATCHPAD_SIZE];
+
+	if (!oneWireReset(bus)) {
+		return false;
+	}
+
+	oneWireWrite(bus, ONEWIRE_MATCH_ROM);
+	for (uint8_t i = 0; i < 8; i++) {
+		oneWireWrite(bus, address[i]);
+	}
+	oneWireWrite(bus, DS18B20_READ_SCRATCHPAD);
+
+	for (uint8_t i = 0; i < DS18B20_SCRATCHPAD_SIZE; i++) {
+		scratchpad[i] = oneWireRead(bus);
+	}
+
+	return decodeScratchpad(scratchpad, raw);
+}
+
+/**
+ * @brief Starts a conversion on every sensor on the bus.
+ *
+ * @return False if no device answered the reset.
+ */
+template <typename Bus>
+ONEWIRE_PROTOCOL_ATTR bool startDS18B20Conversion(Bus& bus) {
+	if (!oneWireReset(bus)) {
+		return false;
+	}
+
+	oneWireWrite(bus, ONEWIRE_SKIP_ROM);
+	oneWireWrite(bus, DS18B20_CONVERT);
+	return true;
+}
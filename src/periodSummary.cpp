@@ -0,0 +1,160 @@
+#include "periodSummary.h"
+
+#include <time.h>
+
+RTC_DATA_ATTR periodSummary periodSummaries[SUMMARY_PERIOD_COUNT];
+
+/**
+ * @brief Formats local seconds as text using strftime.
+ */
+static const char* formatLocalSeconds(uint32_t localSeconds, const char* format) {
+	static char text[20];
+	time_t seconds = localSeconds;
+	struct tm timeInfo;
+	gmtime_r(&seconds, &timeInfo);	// Local seconds have no timezone offset left to apply
+	strftime(text, sizeof(text), format, &timeInfo);
+	return text;
+}
+
+/**
+ * @brief Writes one row per sensor that had readings in a period.
+ */
+static uint8_t writePeriod(uint8_t period, Print& out, const char* const sensorNames[SUMMARY_SENSOR_COUNT]) {
+	const periodSummary& summary = periodSummaries[period];
+	uint32_t start = summary.periodIndex * summaryPeriodSeconds[period];
+	uint8_t rows = 0;
+
+	for (uint8_t sensor = 0; sensor < SUMMARY_SENSOR_COUNT; sensor++) {
+		const sensorSummary& stats = summary.sensors[sensor];
+
+		if (sensorNames[sensor] == nullptr || stats.count + stats.errorCount == 0) {
+			continue;
+		}
+
+		out.printf("%s,%s,%s,%u", summaryPeriodNames[period], formatLocalSeconds(start, "%Y-%m-%d %H:%M"), sensorNames[sensor], stats.count);
+
+		if (stats.count > 0) {
+			float standardDeviation = stats.count > 1 ? sqrtf(stats.m2 / (stats.count - 1)) : 0;
+			out.printf(",%.2f,%.2f", stats.mean / 10.0f, standardDeviation / 10.0f);
+			out.printf(",%.1f,%s", stats.minimum / 10.0f, formatLocalSeconds(start + stats.minimumAt * 60, "%H:%M"));
+			out.printf(",%.1f,%s", stats.maximum / 10.0f, formatLocalSeconds(start + stats.maximumAt * 60, "%H:%M"));
+		} else {
+			out.print(",,,,,,");
+		}
+
+		out.printf(",%u\r\n", stats.errorCount);
+		rows++;
+	}
+
+	return rows;
+}
+
+/**
+ * @brief Starts a new empty period.
+ */
+static void resetPeriod(periodSummary& summary, uint32_t periodIndex) {
+	memset(&summary, 0, sizeof(summary));
+	summary.periodIndex = periodIndex;
+}
+
+/**
+ * @brief Opens any period that has no period open, so the first reading or error has somewhere to go.
+ */
+static void openSummaryPeriods(uint32_t localSeconds) {
+	for (uint8_t period = 0; period < SUMMARY_PERIOD_COUNT; period++) {
+		if (periodSummaries[period].periodIndex == 0) {
+			resetPeriod(periodSummaries[period], localSeconds / summaryPeriodSeconds[period]);
+		}
+	}
+}
+
+bool summaryPeriodsEnded(uint32_t localSeconds) {
+	for (uint8_t period = 0; period < SUMMARY_PERIOD_COUNT; period++) {
+		uint32_t periodIndex = localSeconds / summaryPeriodSeconds[period];
+
+		if (periodSummaries[period].periodIndex != 0 && periodSummaries[period].periodIndex != periodIndex) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+uint8_t closeSummaryPeriods(uint32_t localSeconds, Print& out, const char* const sensorNames[SUMMARY_SENSOR_COUNT]) {
+	uint8_t rows = 0;
+
+	for (uint8_t period = 0; period < SUMMARY_PERIOD_COUNT; period++) {
+		uint32_t periodIndex = localSeconds / summaryPeriodSeconds[period];
+
+		if (periodSummaries[period].periodIndex != periodIndex) {
+			if (periodSummaries[period].periodIndex != 0) {
+				rows += writePeriod(period, out, sensorNames);
+			}
+			resetPeriod(periodSummaries[period], periodIndex);
+		}
+	}
+
+	return rows;
+}
+
+uint8_t flushSummaryPeriods(Print& out, const char* const sensorNames[SUMMARY_SENSOR_COUNT]) {
+	uint8_t rows = 0;
+
+	for (uint8_t period = 0; period < SUMMARY_PERIOD_COUNT; period++) {
+		if (periodSummaries[period].periodIndex != 0) {
+			rows += writePeriod(period, out, sensorNames);
+		}
+		resetPeriod(periodSummaries[period], 0);
+	}
+
+	return rows;
+}
+
+void clearSummaryPeriods() {
+	for (periodSummary& summary : periodSummaries) {
+		resetPeriod(summary, 0);
+	}
+}
+
+void addSummaryReading(uint32_t localSeconds, uint8_t sensor, float temperature) {
+	if (sensor >= SUMMARY_SENSOR_COUNT) {
+		return;
+	}
+
+	int16_t tenths = static_cast<int16_t>(constrain(lroundf(temperature * 10), INT16_MIN, INT16_MAX));
+	openSummaryPeriods(localSeconds);
+
+	for (uint8_t period = 0; period < SUMMARY_PERIOD_COUNT; period++) {
+		uint32_t start = periodSummaries[period].periodIndex * summaryPeriodSeconds[period];
+		uint16_t minutesIntoPeriod = static_cast<uint16_t>((localSeconds - start) / 60);
+		sensorSummary& stats = periodSummaries[period].sensors[sensor];
+
+		if (stats.count == 0 || tenths < stats.minimum) {
+			stats.minimum = tenths;
+			stats.minimumAt = minutesIntoPeriod;
+		}
+
+		if (stats.count == 0 || tenths > stats.maximum) {
+			stats.maximum = tenths;
+			stats.maximumAt = minutesIntoPeriod;
+		}
+
+		// Welford's online mean and variance of the logged tenths
+		stats.count++;
+		float delta = tenths - stats.mean;
+		stats.mean += delta / stats.count;
+		stats.m2 += delta * (tenths - stats.mean);
+	}
+}
+
+void addSummaryError(uint32_t localSeconds, uint8_t sensor) {
+	if (sensor >= SUMMARY_SENSOR_COUNT) {
+		return;
+	}
+
+	openSummaryPeriods(localSeconds);
+
+	for (periodSummary& summary : periodSummaries) {
+		summary.sensors[sensor].errorCount++;
+	}
+}
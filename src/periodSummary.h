@@ -0,0 +1,86 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "logFormat.h"
+
+// Running per-sensor statistics for the current hour and day, kept in RTC memory so they
+// survive deep sleep. When a period ends one finalised row per sensor is written:
+//
+// Period,Start(YYYY-MM-DD HH:MM),Sensor,Count,Mean,StdDev,Min,MinTime(HH:MM),Max,MaxTime(HH:MM),Errors
+//
+// Count is the number of valid readings and Errors the number of ERR readings. StdDev is the
+// sample standard deviation. Every statistic is taken over the readings as logged, rounded to
+// tenths of a degree, not the unrounded sensor values. Min/Max times are the first time each
+// extreme was seen. All times are local. Sensor is the sensor's ROM code, as the log header
+// names it. The rows can be recomputed from the raw log by grouping each sensor's column by
+// local hour or day, which tools/fleetIngest.cpp does with --check-summaries.
+
+constexpr uint8_t SUMMARY_SENSOR_COUNT = 15;  // 3 busses x 5 sensors
+
+struct sensorSummary {
+	uint16_t count;
+	uint16_t errorCount;
+	float mean;			  // Tenths of a degree
+	float m2;			  // Welford sum of squared differences from the mean, in tenths squared
+	int16_t minimum;	  // Tenths of a degree
+	int16_t maximum;	  // Tenths of a degree
+	uint16_t minimumAt;	  // Minutes into the period
+	uint16_t maximumAt;	  // Minutes into the period
+};
+
+struct periodSummary {
+	uint32_t periodIndex;  // Local seconds / period seconds, 0 if no period is open
+	sensorSummary sensors[SUMMARY_SENSOR_COUNT];
+};
+
+/**
+ * @brief Checks whether any open period ends before localSeconds, so rows are due.
+ *
+ * @param localSeconds The local wall clock time in seconds since 1970.
+ * @return True if closeSummaryPeriods() would write rows.
+ */
+bool summaryPeriodsEnded(uint32_t localSeconds);
+
+/**
+ * @brief Writes the rows of any periods that ended before localSeconds and starts new periods.
+ *
+ * Call once per sample before adding readings.
+ *
+ * @param localSeconds The local wall clock time in seconds since 1970.
+ * @param out Where to write the finalised rows.
+ * @param sensorNames The name of each sensor slot, nullptr for empty slots.
+ * @return The number of rows written.
+ */
+uint8_t closeSummaryPeriods(uint32_t localSeconds, Print& out, const char* const sensorNames[SUMMARY_SENSOR_COUNT]);
+
+/**
+ * @brief Writes the rows of the open periods even though they have not ended, and resets them.
+ *
+ * Used when recording stops so the last partial hour and day are not lost.
+ *
+ * @return The number of rows written.
+ */
+uint8_t flushSummaryPeriods(Print& out, const char* const sensorNames[SUMMARY_SENSOR_COUNT]);
+
+/**
+ * @brief Discards the open periods without writing them, used when a new log file is started.
+ */
+void clearSummaryPeriods();
+
+/**
+ * @brief Adds a reading to the open hour and day of a sensor.
+ *
+ * @param localSeconds The local time of the reading.
+ * @param sensor Sensor slot, port index * 5 + sensor index.
+ * @param temperature The temperature in degrees.
+ */
+void addSummaryReading(uint32_t localSeconds, uint8_t sensor, float temperature);
+
+/**
+ * @brief Counts an ERR reading for a sensor in the open hour and day.
+ *
+ * @param localSeconds The local time of the reading.
+ * @param sensor Sensor slot, port index * 5 + sensor index.
+ */
+void addSummaryError(uint32_t localSeconds, uint8_t sensor);
@@ -0,0 +1,296 @@
+#include "sdClock.h"
+
+#include <SD.h>
+
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+
+RTC_DATA_ATTR sdClockCalibration sdClock;
+RTC_DATA_ATTR bool probeFileOnCard = false;	 // Left behind by a calibration that could not remount the card
+
+static const char* const PROBE_PATH = "/.sdprobe";
+static uint8_t probeBuffer[SD_PROBE_CHUNK_BYTES];
+
+/**
+ * @brief Steps a xorshift generator, so probe data does not repeat between chunks or rounds.
+ */
+static uint32_t nextPatternWord(uint32_t& state) {
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+static void fillPattern(uint8_t* buffer, uint32_t seed) {
+	uint32_t state = seed | 1;
+	for (uint16_t i = 0; i < SD_PROBE_CHUNK_BYTES; i += 4) {
+		uint32_t word = nextPatternWord(state);
+		memcpy(buffer + i, &word, 4);
+	}
+}
+
+static bool matchesPattern(const uint8_t* buffer, uint32_t seed) {
+	uint32_t state = seed | 1;
+	for (uint16_t i = 0; i < SD_PROBE_CHUNK_BYTES; i += 4) {
+		uint32_t word = nextPatternWord(state);
+		if (memcmp(buffer + i, &word, 4) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static uint8_t crc7(const uint8_t* data, uint8_t length) {
+	uint8_t crc = 0;
+	for (uint8_t i = 0; i < length; i++) {
+		for (uint8_t bit = 0x80; bit != 0; bit >>= 1) {
+			bool feedback = ((crc & 0x40) != 0) != ((data[i] & bit) != 0);
+			crc = (crc << 1) & 0x7f;
+			if (feedback) {
+				crc ^= 0x09;
+			}
+		}
+	}
+	return crc;
+}
+
+static uint16_t crc16(const uint8_t* data, uint8_t length) {
+	uint16_t crc = 0;
+	for (uint8_t i = 0; i < length; i++) {
+		crc ^= data[i] << 8;
+		for (uint8_t bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+/**
+ * @brief Reads the card's CID register with CMD10, between the SD library's own transfers.
+ *
+ * The SD library does not expose the CID, so the command is sent the way the library sends its
+ * own, with chip select held for the whole exchange. The caller must hold the SPI bus.
+ *
+ * @return True if the card answered and the register passed its CRC.
+ */
+static bool readCID(uint8_t csPin, SPIClass& spi, uint32_t frequency, uint8_t cid[16]) {
+	uint8_t command[6] = {0x40 | 10, 0, 0, 0, 0, 0};
+	command[5] = (crc7(command, 5) << 1) | 1;
+
+	spi.beginTransaction(SPISettings(frequency, MSBFIRST, SPI_MODE0));
+	digitalWrite(csPin, LOW);
+
+	// The card holds its output low while it finishes a write
+	uint32_t start = millis();
+	while (spi.transfer(0xff) != 0xff && millis() - start < 500) {
+	}
+
+	spi.writeBytes(command, sizeof(command));
+
+	// R1 arrives within 8 bytes, then the data token
+	uint8_t response = 0xff;
+	for (uint8_t i = 0; i < 8 && (response & 0x80); i++) {
+		response = spi.transfer(0xff);
+	}
+
+	uint8_t token = 0xff;
+	start = millis();
+	while (response == 0 && token == 0xff && millis() - start < 100) {
+		token = spi.transfer(0xff);
+	}
+
+	bool valid = false;
+	if (token == 0xfe) {
+		memset(cid, 0xff, 16);
+		spi.transfer(cid, 16);
+		uint16_t received = spi.transfer(0xff) << 8;
+		received |= spi.transfer(0xff);
+		valid = received == crc16(cid, 16) && ((crc7(cid, 15) << 1) | 1) == cid[15];
+	}
+
+	digitalWrite(csPin, HIGH);
+	spi.transfer(0xff);
+	spi.endTransaction();
+	return valid;
+}
+
+/**
+ * @brief Identifies the mounted card by its CID, which holds the maker, product and serial number.
+ *
+ * Two cards formatted the same way have the same sector 0, but never the same CID. The read is
+ * CRC checked, so it also fails on a bus that is unreliable at the mounted clock.
+ *
+ * @return 0 if the CID cannot be read.
+ */
+static uint32_t readCardKey(uint8_t csPin, SPIClass& spi, uint32_t frequency) {
+	uint8_t cid[16];
+	if (!readCID(csPin, spi, frequency, cid)) {
+		return 0;
+	}
+	return esp_rom_crc32_le(0, cid, 15) | 1;	// Never 0
+}
+
+/**
+ * @brief Removes the probe file, so it is not left on the card for the user to find.
+ *
+ * Called while the card is mounted at a clock that has worked.
+ */
+static void removeProbeFile() {
+	probeFileOnCard = !SD.remove(PROBE_PATH) && SD.exists(PROBE_PATH);
+}
+
+/**
+ * @brief Writes the probe file and reads it back at the mounted clock.
+ *
+ * @param seed Varies the data so a stale read cannot match.
+ * @param writeUs Incremented by the time spent writing, including the final flush.
+ * @param readUs Incremented by the time spent reading.
+ * @return True if every chunk was written and read back intact.
+ */
+static bool probeRound(uint32_t seed, int64_t& writeUs, int64_t& readUs) {
+	probeFileOnCard = true;
+	File file = SD.open(PROBE_PATH, FILE_WRITE);
+	if (!file) {
+		return false;
+	}
+
+	bool intact = true;
+	for (uint8_t chunk = 0; intact && chunk < SD_PROBE_CHUNKS; chunk++) {
+		fillPattern(probeBuffer, seed + chunk);
+
+		int64_t start = esp_timer_get_time();
+		intact = file.write(probeBuffer, SD_PROBE_CHUNK_BYTES) == SD_PROBE_CHUNK_BYTES;
+		writeUs += esp_timer_get_time() - start;
+	}
+
+	int64_t start = esp_timer_get_time();
+	file.close();
+	writeUs += esp_timer_get_time() - start;
+
+	file = SD.open(PROBE_PATH, FILE_READ);
+	if (!intact || !file) {
+		return false;
+	}
+
+	for (uint8_t chunk = 0; intact && chunk < SD_PROBE_CHUNKS; chunk++) {
+		int64_t start = esp_timer_get_time();
+		intact = file.read(probeBuffer, SD_PROBE_CHUNK_BYTES) == SD_PROBE_CHUNK_BYTES;
+		readUs += esp_timer_get_time() - start;
+
+		intact = intact && matchesPattern(probeBuffer, seed + chunk);
+	}
+
+	file.close();
+	return intact;
+}
+
+/**
+ * @brief Steps the clock up until the probe fails, then remounts at the fastest clock that passed.
+ *
+ * @note The card must be mounted at SD_DEFAULT_FREQUENCY.
+ *
+ * @return True if the card is mounted afterwards.
+ */
+static bool calibrate(uint8_t csPin, SPIClass& spi, uint32_t cardKey) {
+	sdClockCalibration result = {cardKey, SD_DEFAULT_FREQUENCY};
+
+	for (uint32_t frequency : SD_PROBE_FREQUENCIES) {
+		// The card is still mounted at a clock that passed, so a failed step can only leave its own file
+		if (probeFileOnCard) {
+			removeProbeFile();
+		}
+		SD.end();
+
+		if (!SD.begin(csPin, spi, frequency) || readCardKey(csPin, spi, frequency) != cardKey) {
+			result.errors++;
+			ESP_LOGW("SD Clock", "%u kHz: mount failed", frequency / 1000);
+			break;
+		}
+
+		int64_t writeUs = 0;
+		int64_t readUs = 0;
+		uint8_t failedRounds = 0;
+
+		for (uint8_t round = 0; round < SD_PROBE_ROUNDS; round++) {
+			if (!probeRound(frequency ^ (round << 24), writeUs, readUs)) {
+				failedRounds++;
+			}
+		}
+
+		if (failedRounds > 0) {
+			result.errors += failedRounds;
+			ESP_LOGW("SD Clock", "%u kHz: %u of %u rounds failed", frequency / 1000, failedRounds, SD_PROBE_ROUNDS);
+			break;
+		}
+
+		// Bytes per microsecond is MB/s
+		const float probeBytes = SD_PROBE_CHUNK_BYTES * SD_PROBE_CHUNKS * SD_PROBE_ROUNDS;
+		result.frequency = frequency;
+		result.writeMBps = probeBytes / writeUs;
+		result.readMBps = probeBytes / readUs;
+		ESP_LOGI("SD Clock", "%u kHz: write %.2f MB/s, read %.2f MB/s", frequency / 1000, result.writeMBps, result.readMBps);
+	}
+
+	SD.end();
+
+	if (!SD.begin(csPin, spi, result.frequency)) {
+		result.errors++;
+		result.frequency = SD_DEFAULT_FREQUENCY;
+		result.writeMBps = 0;
+		result.readMBps = 0;
+
+		if (!SD.begin(csPin, spi, SD_DEFAULT_FREQUENCY)) {
+			return false;	// The probe file is removed on the next mount
+		}
+	}
+
+	removeProbeFile();
+	sdClock = result;
+
+	ESP_LOGI("SD Clock", "Card %08x: %u kHz, write %.2f MB/s, read %.2f MB/s, %u errors", sdClock.cardKey, sdClock.frequency / 1000, sdClock.writeMBps,
+			 sdClock.readMBps, sdClock.errors);
+	return true;
+}
+
+bool mountSDCard(uint8_t csPin, SPIClass& spi, bool allowCalibration) {
+	if (SD.cardType() != CARD_NONE) {
+		return true;
+	}
+
+	bool mounted = false;
+
+	if (sdClock.frequency != 0) {
+		mounted = SD.begin(csPin, spi, sdClock.frequency) && readCardKey(csPin, spi, sdClock.frequency) == sdClock.cardKey;
+
+		if (!mounted) {
+			SD.end();
+			ESP_LOGI("SD Clock", "Card changed or unstable at %u kHz", sdClock.frequency / 1000);
+
+			// Not trusted again, even for the same card, until calibration has verified it
+			sdClock.frequency = 0;
+			sdClock.writeMBps = 0;
+			sdClock.readMBps = 0;
+		}
+	}
+
+	if (!mounted) {
+		mounted = SD.begin(csPin, spi, SD_DEFAULT_FREQUENCY);
+
+		if (mounted && allowCalibration) {
+			uint32_t cardKey = readCardKey(csPin, spi, SD_DEFAULT_FREQUENCY);
+			if (cardKey != 0) {
+				mounted = calibrate(csPin, spi, cardKey);
+			}
+		}
+	}
+
+	if (mounted && probeFileOnCard) {
+		removeProbeFile();
+	}
+
+	return mounted;
+}
+
+const sdClockCalibration& getSDClockCalibration() {
+	return sdClock;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <Arduino.h>
+#include <SPI.h>
+
+#include "config.h"
+
+// Runs the SD card at the fastest SPI clock it has been verified at.
+//
+// The first time a card is mounted where it may be written, the clock is stepped up through
+// SD_PROBE_FREQUENCIES. At each step a probe file is written and read back, with the card in
+// CRC mode so a corrupted transfer fails rather than returning bad data, and the fastest clock
+// that passed every round is kept. The result is kept in RTC memory with a key made from the
+// card's CID register, so later mounts, including every deep sleep wake, go straight to that
+// clock. Each of those mounts reads the CID back at the stored clock and checks its CRC. A
+// different card, or the same card failing that check, is mounted at SD_DEFAULT_FREQUENCY and
+// the stored clock is dropped, so it is only used again once calibration has verified it.
+//
+// The display shares the bus but keeps the SPI_FREQUENCY build flag, which TFT_eSPI only reads
+// at compile time.
+
+constexpr uint32_t SD_DEFAULT_FREQUENCY = 4000000;
+constexpr uint32_t SD_PROBE_FREQUENCIES[] = {8000000, 10000000, 16000000, 20000000, 26666667, 40000000};	 // 80 MHz / n
+constexpr uint8_t SD_PROBE_CHUNKS = 8;	// 32 KiB per round, enough to time
+constexpr uint8_t SD_PROBE_ROUNDS = 2;
+
+struct sdClockCalibration {
+	uint32_t cardKey;	 // CRC32 of the CID, which holds the maker, product and serial number
+	uint32_t frequency;	 // 0 until the card has been calibrated
+	float writeMBps;	 // At the chosen frequency
+	float readMBps;
+	uint16_t errors;  // Failed mounts, transfers and mismatched data while stepping up
+};
+
+/**
+ * @brief Mounts the SD card at its calibrated clock, calibrating it first if allowed.
+ *
+ * Does nothing if the card is already mounted.
+ *
+ * @param csPin The card's chip select pin.
+ * @param spi The SPI bus the card is on.
+ * @param allowCalibration Whether an uncalibrated card may have the probe file written now.
+ * @return True if the card is mounted.
+ */
+bool mountSDCard(uint8_t csPin, SPIClass& spi, bool allowCalibration);
+
+/**
+ * @brief Gets the calibration of the last card calibrated.
+ */
+const sdClockCalibration& getSDClockCalibration();
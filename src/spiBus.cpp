@@ -0,0 +1,16 @@
+#include "spiBus.h"
+
+static SemaphoreHandle_t spiBusMutex;
+static StaticSemaphore_t spiBusMutexBuffer;
+
+void createSPIBusLock() {
+	spiBusMutex = xSemaphoreCreateRecursiveMutexStatic(&spiBusMutexBuffer);
+}
+
+void takeSPIBus() {
+	xSemaphoreTakeRecursive(spiBusMutex, portMAX_DELAY);
+}
+
+void giveSPIBus() {
+	xSemaphoreGiveRecursive(spiBusMutex);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <Arduino.h>
+
+// One lock for everything on the shared SPI bus.
+//
+// The screen and the SD card share the bus, and the card is reached through the file system,
+// raw USB sector transfers, the read-only virtual volume, the clock calibration and the Wi-Fi
+// offload, from several tasks. Every one of them holds this lock for the whole of each access,
+// so a file system operation is never interleaved with a raw transfer or a screen update. The
+// lock is recursive, so a function holding it can call another that takes it.
+
+/**
+ * @brief Creates the lock, before any task can use the bus.
+ */
+void createSPIBusLock();
+
+/**
+ * @brief Waits for and takes the bus. Every take must be matched by a giveSPIBus() in the same task.
+ */
+void takeSPIBus();
+
+/**
+ * @brief Gives the bus back.
+ */
+void giveSPIBus();
@@ -0,0 +1,128 @@
+#include "temperatureHistory.h"
+
+RTC_DATA_ATTR historyLevel historyLevels[HISTORY_LEVEL_COUNT];
+
+/**
+ * @brief Empties the open bucket of a sensor.
+ */
+static void resetAccumulator(historyAccumulator& accumulator) {
+	accumulator.sum = 0;
+	accumulator.count = 0;
+	accumulator.min = INT16_MAX;
+	accumulator.max = INT16_MIN;
+}
+
+/**
+ * @brief Summarises an open bucket into a closed bucket.
+ */
+static historyBucket closeAccumulator(const historyAccumulator& accumulator) {
+	historyBucket bucket = {HISTORY_NO_DATA, 0, 0};
+
+	if (accumulator.count > 0) {
+		int32_t halfCount = accumulator.sum >= 0 ? accumulator.count / 2 : -(accumulator.count / 2);
+		bucket.mean = static_cast<int16_t>((accumulator.sum + halfCount) / accumulator.count);
+		bucket.belowMean = static_cast<uint8_t>(min(bucket.mean - accumulator.min, 255));
+		bucket.aboveMean = static_cast<uint8_t>(min(accumulator.max - bucket.mean, 255));
+	}
+
+	return bucket;
+}
+
+/**
+ * @brief Empties the open and closed buckets of a range of sensors at a level.
+ */
+static void clearLevel(historyLevel& level, uint8_t firstSensor, uint8_t count) {
+	for (uint8_t sensor = firstSensor; sensor < firstSensor + count && sensor < HISTORY_SENSOR_COUNT; sensor++) {
+		resetAccumulator(level.open[sensor]);
+
+		for (historyBucket& bucket : level.closed[sensor]) {
+			bucket = {HISTORY_NO_DATA, 0, 0};
+		}
+	}
+}
+
+/**
+ * @brief Closes the open bucket of every sensor at a level and starts the next one.
+ */
+static void closeBucket(historyLevel& level) {
+	level.newest = (level.newest + 1) % HISTORY_BUCKET_COUNT;
+
+	for (uint8_t sensor = 0; sensor < HISTORY_SENSOR_COUNT; sensor++) {
+		level.closed[sensor][level.newest] = closeAccumulator(level.open[sensor]);
+		resetAccumulator(level.open[sensor]);
+	}
+
+	level.bucketIndex++;
+}
+
+void advanceHistory(uint32_t localSeconds) {
+	for (uint8_t levelIndex = 0; levelIndex < HISTORY_LEVEL_COUNT; levelIndex++) {
+		historyLevel& level = historyLevels[levelIndex];
+		uint32_t bucketIndex = localSeconds / historyBucketSeconds[levelIndex];
+
+		if (bucketIndex < level.bucketIndex && level.bucketIndex != 0 &&
+			level.bucketIndex * historyBucketSeconds[levelIndex] - localSeconds <= HISTORY_CLOCK_STEP_BACK_SECONDS) {
+			// The clocks went back or the time sync corrected the clock, so keep filling the open bucket
+			continue;
+		}
+
+		if (level.bucketIndex == 0 || bucketIndex < level.bucketIndex) {
+			// First use, or the clock went a long way backwards
+			level.bucketIndex = bucketIndex;
+			clearLevel(level, 0, HISTORY_SENSOR_COUNT);
+			continue;
+		}
+
+		// Once every bucket has been closed the rest of a long gap is empty anyway
+		for (uint8_t closed = 0; level.bucketIndex < bucketIndex && closed < HISTORY_BUCKET_COUNT; closed++) {
+			closeBucket(level);
+		}
+
+		level.bucketIndex = bucketIndex;
+	}
+}
+
+void addHistoryReading(uint8_t sensor, float temperature) {
+	if (sensor >= HISTORY_SENSOR_COUNT) {
+		return;
+	}
+
+	int16_t tenths = static_cast<int16_t>(constrain(lroundf(temperature * 10), INT16_MIN + 1, INT16_MAX));
+
+	for (historyLevel& level : historyLevels) {
+		historyAccumulator& accumulator = level.open[sensor];
+		accumulator.sum += tenths;
+		accumulator.count++;
+		accumulator.min = min(accumulator.min, tenths);
+		accumulator.max = max(accumulator.max, tenths);
+	}
+}
+
+void clearHistory(uint8_t firstSensor, uint8_t count) {
+	for (historyLevel& level : historyLevels) {
+		clearLevel(level, firstSensor, count);
+	}
+}
+
+bool getHistoryBucket(uint8_t level, uint8_t sensor, uint8_t age, float& minimum, float& average, float& maximum) {
+	if (level >= HISTORY_LEVEL_COUNT || sensor >= HISTORY_SENSOR_COUNT || age > HISTORY_BUCKET_COUNT) {
+		return false;
+	}
+
+	historyBucket bucket;
+	if (age == 0) {
+		bucket = closeAccumulator(historyLevels[level].open[sensor]);
+	} else {
+		uint8_t position = (historyLevels[level].newest + HISTORY_BUCKET_COUNT + 1 - age) % HISTORY_BUCKET_COUNT;
+		bucket = historyLevels[level].closed[sensor][position];
+	}
+
+	if (bucket.mean == HISTORY_NO_DATA) {
+		return false;
+	}
+
+	average = bucket.mean / 10.0f;
+	minimum = (bucket.mean - bucket.belowMean) / 10.0f;
+	maximum = (bucket.mean + bucket.aboveMean) / 10.0f;
+	return true;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Multi-resolution temperature history kept in RTC memory so it survives deep sleep.
+// Each level holds the last HISTORY_BUCKET_COUNT buckets of min/max/mean per sensor
+// plus the bucket that is currently filling.
+
+constexpr uint8_t HISTORY_SENSOR_COUNT = 15;  // 3 busses x 5 sensors
+constexpr uint8_t HISTORY_LEVEL_COUNT = 3;
+constexpr uint8_t HISTORY_BUCKET_COUNT = 12;
+constexpr int16_t HISTORY_NO_DATA = INT16_MIN;
+constexpr uint32_t HISTORY_CLOCK_STEP_BACK_SECONDS = 60 * 60;  // Largest step back that keeps the history, as when the clocks go back
+
+// Seconds covered by one bucket at each level, 12 hours, 3 days and 12 days in total
+constexpr uint32_t historyBucketSeconds[HISTORY_LEVEL_COUNT] = {60 * 60, 6 * 60 * 60, 24 * 60 * 60};
+constexpr const char* historyLevelNames[HISTORY_LEVEL_COUNT] = {"Last 12 Hours", "Last 3 Days", "Last 12 Days"};
+
+// A closed bucket, temperatures in tenths of a degree
+struct historyBucket {
+	int16_t mean;		// HISTORY_NO_DATA if there were no readings
+	uint8_t belowMean;	// mean - min, saturated at 25.5 degrees
+	uint8_t aboveMean;	// max - mean, saturated at 25.5 degrees
+};
+
+// Running totals for the bucket that is currently filling
+struct historyAccumulator {
+	int32_t sum;
+	uint16_t count;
+	int16_t min;
+	int16_t max;
+};
+
+struct historyLevel {
+	uint32_t bucketIndex;  // Local seconds / bucket seconds of the open bucket
+	uint8_t newest;		   // Ring position of the most recently closed bucket
+	historyAccumulator open[HISTORY_SENSOR_COUNT];
+	historyBucket closed[HISTORY_SENSOR_COUNT][HISTORY_BUCKET_COUNT];
+};
+
+/**
+ * @brief Closes any buckets whose period has ended.
+ *
+ * Call once per sample before adding readings. Skipped periods are recorded as empty buckets.
+ * The work is bounded by HISTORY_BUCKET_COUNT per level however long the gap. If the clock
+ * steps back by up to HISTORY_CLOCK_STEP_BACK_SECONDS before the start of the open bucket, the
+ * readings go into the open bucket until the clock catches up. A longer step back clears the
+ * history.
+ *
+ * @param localSeconds The local wall clock time in seconds since 1970.
+ */
+void advanceHistory(uint32_t localSeconds);
+
+/**
+ * @brief Adds a reading to the open bucket of every level.
+ *
+ * @param sensor Sensor slot, port index * 5 + sensor index.
+ * @param temperature The temperature in degrees.
+ */
+void addHistoryReading(uint8_t sensor, float temperature);
+
+/**
+ * @brief Forgets the history of a range of sensor slots, used when the sensors on a bus change.
+ *
+ * @param firstSensor The first sensor slot to clear.
+ * @param count The number of slots to clear.
+ */
+void clearHistory(uint8_t firstSensor, uint8_t count);
+
+/**
+ * @brief Gets one bucket of a sensor's history.
+ *
+ * @param level The history level.
+ * @param sensor The sensor slot.
+ * @param age 0 for the open bucket, 1 for the most recently closed bucket and so on up to HISTORY_BUCKET_COUNT.
+ * @param minimum Set to the minimum temperature in the bucket.
+ * @param average Set to the mean temperature in the bucket.
+ * @param maximum Set to the maximum temperature in the bucket.
+ * @return True if the bucket has data.
+ */
+bool getHistoryBucket(uint8_t level, uint8_t sensor, uint8_t age, float& minimum, float& average, float& maximum);
@@ -0,0 +1,705 @@
+#include "virtualFat.h"
+
+#if USB_VIRTUAL_VOLUME
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+constexpr uint8_t VIRTUAL_NAME_LENGTH = 63;
+constexpr uint8_t DIR_ENTRY_SIZE = 32;
+constexpr uint8_t DIR_ENTRIES_PER_SECTOR = VIRTUAL_SECTOR_SIZE / DIR_ENTRY_SIZE;
+constexpr uint8_t LFN_CHARS_PER_ENTRY = 13;
+constexpr uint32_t FAT32_END_OF_CHAIN = 0x0FFFFFFF;
+
+// Virtual volume layout constants
+constexpr uint16_t RESERVED_SECTORS = 32;
+constexpr uint8_t FAT_COUNT = 2;
+constexpr uint8_t FSINFO_SECTOR = 1;
+constexpr uint8_t BACKUP_BOOT_SECTOR = 6;
+constexpr uint32_t ROOT_CLUSTER = 2;
+constexpr const char VOLUME_LABEL[] = "KEARECORDER";
+
+// Attribute bits of a directory entry
+constexpr uint8_t ATTR_READ_ONLY = 0x01;
+constexpr uint8_t ATTR_HIDDEN = 0x02;
+constexpr uint8_t ATTR_SYSTEM = 0x04;
+constexpr uint8_t ATTR_VOLUME_ID = 0x08;
+constexpr uint8_t ATTR_DIRECTORY = 0x10;
+constexpr uint8_t ATTR_ARCHIVE = 0x20;
+constexpr uint8_t ATTR_LONG_NAME = 0x0F;
+
+// Where each of the 13 UTF-16 characters of a long name entry are stored
+constexpr uint8_t lfnCharOffsets[LFN_CHARS_PER_ENTRY] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+
+// The FAT16/FAT32 file system on the card
+struct physicalVolume {
+	uint32_t fatStart;		   // First sector of the first FAT
+	uint32_t rootDirStart;	   // First sector of the FAT16 root directory
+	uint32_t rootDirSectors;   // 0 for FAT32, where the root directory is a cluster chain
+	uint32_t rootCluster;	   // FAT32 root directory cluster
+	uint32_t dataStart;		   // First sector of cluster 2
+	uint32_t clusterCount;
+	uint32_t volumeId;
+	uint8_t sectorsPerCluster;
+	bool fat32;
+};
+
+// A run of contiguous clusters on the card
+struct clusterRun {
+	uint32_t firstCluster;
+	uint32_t length;
+};
+
+struct virtualFile {
+	char name[VIRTUAL_NAME_LENGTH + 1];
+	uint32_t size;
+	uint16_t createTime;
+	uint16_t createDate;
+	uint16_t accessDate;
+	uint16_t writeTime;
+	uint16_t writeDate;
+	std::vector<clusterRun> runs;  // Clusters on the card, in file order
+	uint32_t firstCluster;		   // First virtual cluster
+	uint32_t dataClusters;		   // Virtual clusters holding data
+	uint32_t reservedClusters;	   // Virtual clusters set aside, including room to grow
+	uint16_t firstEntry;		   // Index of the first directory entry in the virtual root directory
+	uint8_t lfnEntries;
+};
+
+// Clusters the last layout set aside for a growing file
+struct growthReservation {
+	char name[VIRTUAL_NAME_LENGTH + 1];
+	uint32_t reservedClusters;
+};
+
+static sectorReader readPhysical = nullptr;
+static physicalVolume physical;
+static std::vector<virtualFile> files;
+static std::vector<growthReservation> reservations;
+
+static uint8_t fatCache[VIRTUAL_SECTOR_SIZE];
+static uint32_t fatCacheSector = UINT32_MAX;
+
+// Virtual volume layout
+static uint32_t totalSectors;
+static uint32_t fatSectors;
+static uint32_t dataStart;
+static uint32_t clusterCount;
+static uint32_t rootClusters;
+static uint16_t rootEntryCount;
+static uint8_t sectorsPerCluster;
+
+static uint16_t read16(const uint8_t* data) {
+	return data[0] | (data[1] << 8);
+}
+
+static uint32_t read32(const uint8_t* data) {
+	return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+static void write16(uint8_t* data, uint16_t value) {
+	data[0] = value & 0xFF;
+	data[1] = value >> 8;
+}
+
+static void write32(uint8_t* data, uint32_t value) {
+	write16(data, value & 0xFFFF);
+	write16(data + 2, value >> 16);
+}
+
+/**
+ * @brief Checks whether a sector looks like a FAT boot sector rather than a partition table.
+ */
+static bool isBootSector(const uint8_t* sector) {
+	uint8_t sectorsPerCluster = sector[13];
+
+	return (sector[0] == 0xEB || sector[0] == 0xE9) && read16(sector + 11) == VIRTUAL_SECTOR_SIZE &&
+		   sectorsPerCluster != 0 && (sectorsPerCluster & (sectorsPerCluster - 1)) == 0 &&
+		   read16(sector + 14) != 0 && (sector[16] == 1 || sector[16] == 2) &&
+		   sector[510] == 0x55 && sector[511] == 0xAA;
+}
+
+/**
+ * @brief Reads the card's partition table and boot sector.
+ */
+static bool mountPhysicalVolume() {
+	uint8_t sector[VIRTUAL_SECTOR_SIZE];
+	uint32_t partitionStart = 0;
+
+	if (!readPhysical(0, sector)) {
+		return false;
+	}
+
+	if (!isBootSector(sector)) {
+		// Use the first partition of the partition table
+		partitionStart = read32(sector + 446 + 8);
+		if (partitionStart == 0 || !readPhysical(partitionStart, sector) || !isBootSector(sector)) {
+			return false;
+		}
+	}
+
+	uint16_t reservedSectors = read16(sector + 14);
+	uint8_t fatCount = sector[16];
+	uint16_t rootEntries = read16(sector + 17);
+	uint32_t volumeSectors = read16(sector + 19) ? read16(sector + 19) : read32(sector + 32);
+	uint32_t sectorsPerFat = read16(sector + 22) ? read16(sector + 22) : read32(sector + 36);
+
+	physical.sectorsPerCluster = sector[13];
+	physical.fatStart = partitionStart + reservedSectors;
+	physical.rootDirStart = physical.fatStart + fatCount * sectorsPerFat;
+	physical.rootDirSectors = (rootEntries * DIR_ENTRY_SIZE + VIRTUAL_SECTOR_SIZE - 1) / VIRTUAL_SECTOR_SIZE;
+	physical.dataStart = physical.rootDirStart + physical.rootDirSectors;
+
+	uint32_t metadataSectors = physical.dataStart - partitionStart;
+	if (volumeSectors <= metadataSectors) {
+		return false;
+	}
+	physical.clusterCount = (volumeSectors - metadataSectors) / physical.sectorsPerCluster;
+
+	// The cluster count alone decides the FAT type
+	if (physical.clusterCount < 4085) {
+		return false;  // FAT12
+	}
+	physical.fat32 = physical.clusterCount >= 65525;
+	physical.rootCluster = physical.fat32 ? read32(sector + 44) : 0;
+	physical.volumeId = read32(sector + (physical.fat32 ? 67 : 39));
+
+	fatCacheSector = UINT32_MAX;
+	return true;
+}
+
+/**
+ * @brief Checks whether a cluster number points at a data cluster on the card.
+ */
+static bool isPhysicalCluster(uint32_t cluster) {
+	return cluster >= 2 && cluster < physical.clusterCount + 2;
+}
+
+/**
+ * @brief Reads the FAT entry of a cluster on the card.
+ *
+ * @return The next cluster in the chain, or 0 if the read failed.
+ */
+static uint32_t readFatEntry(uint32_t cluster) {
+	uint32_t offset = cluster * (physical.fat32 ? 4 : 2);
+	uint32_t sector = physical.fatStart + offset / VIRTUAL_SECTOR_SIZE;
+
+	if (sector != fatCacheSector) {
+		if (!readPhysical(sector, fatCache)) {
+			fatCacheSector = UINT32_MAX;
+			return 0;
+		}
+		fatCacheSector = sector;
+	}
+
+	offset %= VIRTUAL_SECTOR_SIZE;
+	return physical.fat32 ? read32(fatCache + offset) & 0x0FFFFFFF : read16(fatCache + offset);
+}
+
+/**
+ * @brief Calculates the checksum of a short name that ties long name entries to it.
+ */
+static uint8_t shortNameChecksum(const uint8_t* shortName) {
+	uint8_t sum = 0;
+	for (uint8_t i = 0; i < 11; i++) {
+		sum = ((sum & 1) << 7) + (sum >> 1) + shortName[i];
+	}
+	return sum;
+}
+
+/**
+ * @brief Converts a padded 8.3 name to text, honouring the lower case flags.
+ */
+static void shortNameToText(const uint8_t* entry, char* name) {
+	uint8_t length = 0;
+
+	for (uint8_t i = 0; i < 11; i++) {
+		if (i == 8 && entry[8] != ' ') {
+			name[length++] = '.';
+		}
+
+		char c = (i == 0 && entry[0] == 0x05) ? 0xE5 : entry[i];
+		if (c == ' ') {
+			continue;
+		}
+
+		bool lowerCase = entry[12] & (i < 8 ? 0x08 : 0x10);
+		name[length++] = lowerCase ? tolower(c) : c;
+	}
+
+	name[length] = '\0';
+}
+
+/**
+ * @brief Follows a file's cluster chain on the card, truncating the size if the chain is short.
+ */
+static void mapFileClusters(virtualFile& file, uint32_t firstCluster) {
+	uint32_t clusterBytes = physical.sectorsPerCluster * VIRTUAL_SECTOR_SIZE;
+	uint32_t clustersNeeded = (file.size + clusterBytes - 1) / clusterBytes;
+	uint32_t cluster = firstCluster;
+
+	for (uint32_t index = 0; index < clustersNeeded; index++) {
+		if (!isPhysicalCluster(cluster)) {
+			file.size = index * clusterBytes;
+			return;
+		}
+
+		if (!file.runs.empty() && file.runs.back().firstCluster + file.runs.back().length == cluster) {
+			file.runs.back().length++;
+		} else {
+			file.runs.push_back({cluster, 1});
+		}
+
+		if (index + 1 < clustersNeeded) {
+			cluster = readFatEntry(cluster);
+		}
+	}
+}
+
+/**
+ * @brief Collects the regular files in the card's root directory.
+ */
+static bool scanPhysicalRootDirectory() {
+	uint8_t sector[VIRTUAL_SECTOR_SIZE];
+	char longName[VIRTUAL_NAME_LENGTH + 1];
+	uint8_t longNameChecksum = 0;
+	uint8_t longNameNextOrder = 0;	// The sequence number expected next, 0 if no long name is pending
+	bool longNameValid = false;
+
+	uint32_t cluster = physical.rootCluster;
+	uint32_t sectorIndex = 0;
+
+	for (uint32_t visited = 0; visited <= physical.clusterCount; visited++) {
+		uint32_t lba;
+
+		if (physical.fat32) {
+			if (sectorIndex == physical.sectorsPerCluster) {
+				cluster = readFatEntry(cluster);
+				sectorIndex = 0;
+			}
+			if (!isPhysicalCluster(cluster)) {
+				return true;
+			}
+			lba = physical.dataStart + (cluster - 2) * physical.sectorsPerCluster + sectorIndex++;
+		} else {
+			if (sectorIndex == physical.rootDirSectors) {
+				return true;
+			}
+			lba = physical.rootDirStart + sectorIndex++;
+		}
+
+		if (!readPhysical(lba, sector)) {
+			return false;
+		}
+
+		for (uint16_t offset = 0; offset < VIRTUAL_SECTOR_SIZE; offset += DIR_ENTRY_SIZE) {
+			const uint8_t* entry = sector + offset;
+			uint8_t attributes = entry[11];
+
+			if (entry[0] == 0x00) {
+				return true;  // End of directory
+			}
+
+			if (entry[0] == 0xE5) {
+				longNameValid = false;
+				continue;  // Deleted
+			}
+
+			if (attributes == ATTR_LONG_NAME) {
+				uint8_t order = entry[0] & 0x1F;
+
+				if (entry[0] & 0x40) {
+					memset(longName, 0, sizeof(longName));
+					longNameChecksum = entry[13];
+					longNameNextOrder = order;
+					longNameValid = order > 0;
+				}
+
+				if (!longNameValid || order != longNameNextOrder || entry[13] != longNameChecksum) {
+					longNameValid = false;
+					continue;
+				}
+
+				for (uint8_t i = 0; i < LFN_CHARS_PER_ENTRY; i++) {
+					uint16_t position = (order - 1) * LFN_CHARS_PER_ENTRY + i;
+					uint16_t c = read16(entry + lfnCharOffsets[i]);
+
+					if (c == 0x0000 || c == 0xFFFF || position >= VIRTUAL_NAME_LENGTH) {
+						break;
+					}
+					longName[position] = c < 0x80 ? c : '_';
+				}
+
+				longNameNextOrder--;
+				continue;
+			}
+
+			bool hasLongName = longNameValid && longNameNextOrder == 0 && shortNameChecksum(entry) == longNameChecksum;
+			longNameValid = false;
+
+			if (attributes & (ATTR_VOLUME_ID | ATTR_DIRECTORY | ATTR_HIDDEN | ATTR_SYSTEM) || files.size() >= VIRTUAL_MAX_FILES) {
+				continue;
+			}
+
+			virtualFile file = {};
+			if (hasLongName) {
+				strcpy(file.name, longName);
+			} else {
+				shortNameToText(entry, file.name);
+			}
+
+			file.createTime = read16(entry + 14);
+			file.createDate = read16(entry + 16);
+			file.accessDate = read16(entry + 18);
+			file.writeTime = read16(entry + 22);
+			file.writeDate = read16(entry + 24);
+			file.size = read32(entry + 28);
+
+			uint32_t firstCluster = read16(entry + 26) | (physical.fat32 ? read16(entry + 20) << 16 : 0);
+			mapFileClusters(file, firstCluster);
+
+			files.push_back(file);
+		}
+	}
+
+	return true;
+}
+
+/**
+ * @brief Picks the cluster size Microsoft's format tool would use for a FAT32 volume.
+ */
+static uint8_t chooseSectorsPerCluster(uint32_t sectors) {
+	if (sectors <= 532480) return 1;		 // 260 MB
+	if (sectors <= 16777216) return 8;		 // 8 GB
+	if (sectors <= 33554432) return 16;		 // 16 GB
+	if (sectors <= 67108864) return 32;		 // 32 GB
+	return 64;
+}
+
+/**
+ * @brief Lays out the virtual FAT32 volume: root directory first, then each file's clusters.
+ */
+static void layoutVirtualVolume(const char* const growingFiles[], uint8_t growingFileCount) {
+	// Growing files go last so their extra clusters never move the other files
+	auto isGrowing = [&](const virtualFile& file) {
+		for (uint8_t i = 0; i < growingFileCount; i++) {
+			if (growingFiles[i] != nullptr && strcmp(file.name, growingFiles[i]) == 0) {
+				return true;
+			}
+		}
+		return false;
+	};
+	std::stable_partition(files.begin(), files.end(), [&](const virtualFile& file) { return !isGrowing(file); });
+
+	sectorsPerCluster = chooseSectorsPerCluster(totalSectors);
+
+	// FAT size from the FAT32 formula in Microsoft's FAT specification
+	uint32_t fatDivisor = (256 * sectorsPerCluster + FAT_COUNT) / 2;
+	fatSectors = (totalSectors - RESERVED_SECTORS + fatDivisor - 1) / fatDivisor;
+	dataStart = RESERVED_SECTORS + FAT_COUNT * fatSectors;
+	clusterCount = (totalSectors - dataStart) / sectorsPerCluster;
+
+	// Directory entries: the volume label, then long name entries and a short entry per file
+	rootEntryCount = 1;
+	for (virtualFile& file : files) {
+		file.firstEntry = rootEntryCount;
+		file.lfnEntries = (strlen(file.name) + LFN_CHARS_PER_ENTRY - 1) / LFN_CHARS_PER_ENTRY;
+		rootEntryCount += file.lfnEntries + 1;
+	}
+
+	uint32_t clusterBytes = sectorsPerCluster * VIRTUAL_SECTOR_SIZE;
+	rootClusters = (rootEntryCount * DIR_ENTRY_SIZE + clusterBytes - 1) / clusterBytes;
+
+	uint32_t nextCluster = ROOT_CLUSTER + rootClusters;
+	for (size_t index = 0; index < files.size(); index++) {
+		virtualFile& file = files[index];
+		file.dataClusters = (file.size + clusterBytes - 1) / clusterBytes;
+		file.reservedClusters = file.dataClusters + (isGrowing(file) ? VIRTUAL_GROWTH_CLUSTERS : 0);
+
+		// Keep a growing file's room while it still fits, so the growing file after it doesn't move
+		for (const growthReservation& reservation : reservations) {
+			if (isGrowing(file) && strcmp(reservation.name, file.name) == 0 && file.dataClusters <= reservation.reservedClusters) {
+				file.reservedClusters = reservation.reservedClusters;
+			}
+		}
+
+		if (nextCluster + file.reservedClusters > clusterCount + 2) {
+			// Out of room, which only happens if the files fill a card with smaller clusters
+			files.resize(index);
+			break;
+		}
+
+		file.firstCluster = nextCluster;
+		nextCluster += file.reservedClusters;
+	}
+
+	reservations.clear();
+	for (const virtualFile& file : files) {
+		if (isGrowing(file)) {
+			growthReservation reservation = {};
+			strcpy(reservation.name, file.name);
+			reservation.reservedClusters = file.reservedClusters;
+			reservations.push_back(reservation);
+		}
+	}
+}
+
+bool buildVirtualVolume(sectorReader readPhysicalSector, uint32_t volumeSectors, const char* const growingFiles[], uint8_t growingFileCount) {
+	readPhysical = readPhysicalSector;
+	totalSectors = std::max(volumeSectors, VIRTUAL_MIN_SECTORS);
+	files.clear();
+
+	bool mounted = mountPhysicalVolume() && scanPhysicalRootDirectory();
+	if (!mounted) {
+		files.clear();
+	}
+
+	layoutVirtualVolume(growingFiles, growingFileCount);
+	return mounted;
+}
+
+uint16_t getVirtualFileCount() {
+	return files.size();
+}
+
+uint32_t getVirtualSectorCount() {
+	return totalSectors;
+}
+
+/**
+ * @brief Finds the file whose directory entries or clusters include a position.
+ *
+ * @param position A directory entry index or a cluster number.
+ * @param start The file's first directory entry or first cluster.
+ * @param length The number of directory entries or clusters the file occupies.
+ * @return The file, or nullptr if no file occupies the position.
+ */
+template <typename Start, typename Length>
+static const virtualFile* findFile(uint32_t position, Start start, Length length) {
+	auto after = std::upper_bound(files.begin(), files.end(), position,
+								  [&](uint32_t value, const virtualFile& file) { return value < start(file); });
+
+	if (after == files.begin()) {
+		return nullptr;
+	}
+
+	const virtualFile& file = *(after - 1);
+	return position < start(file) + length(file) ? &file : nullptr;
+}
+
+static const virtualFile* findFileByCluster(uint32_t cluster) {
+	return findFile(
+		cluster, [](const virtualFile& file) { return file.firstCluster; },
+		[](const virtualFile& file) { return file.reservedClusters; });
+}
+
+static const virtualFile* findFileByEntry(uint32_t entryIndex) {
+	return findFile(
+		entryIndex, [](const virtualFile& file) { return static_cast<uint32_t>(file.firstEntry); },
+		[](const virtualFile& file) { return static_cast<uint32_t>(file.lfnEntries + 1); });
+}
+
+static void generateBootSector(uint8_t* sector) {
+	const uint8_t jump[] = {0xEB, 0x58, 0x90};
+	memcpy(sector, jump, sizeof(jump));
+	memcpy(sector + 3, "MSWIN4.1", 8);
+	write16(sector + 11, VIRTUAL_SECTOR_SIZE);
+	sector[13] = sectorsPerCluster;
+	write16(sector + 14, RESERVED_SECTORS);
+	sector[16] = FAT_COUNT;
+	sector[21] = 0xF8;			 // Fixed media
+	write16(sector + 24, 63);	 // Sectors per track
+	write16(sector + 26, 255);	 // Heads
+	write32(sector + 32, totalSectors);
+	write32(sector + 36, fatSectors);
+	write32(sector + 44, ROOT_CLUSTER);
+	write16(sector + 48, FSINFO_SECTOR);
+	write16(sector + 50, BACKUP_BOOT_SECTOR);
+	sector[64] = 0x80;	// Drive number
+	sector[66] = 0x29;	// Extended boot signature
+	write32(sector + 67, physical.volumeId ^ 0x4B454100);
+	memcpy(sector + 71, VOLUME_LABEL, 11);
+	memcpy(sector + 82, "FAT32   ", 8);
+	sector[510] = 0x55;
+	sector[511] = 0xAA;
+}
+
+static void generateFsInfoSector(uint8_t* sector) {
+	write32(sector, 0x41615252);
+	write32(sector + 484, 0x61417272);
+	write32(sector + 488, 0xFFFFFFFF);	// Free cluster count unknown
+	write32(sector + 492, 0xFFFFFFFF);	// No hint for the next free cluster
+	write32(sector + 508, 0xAA550000);
+}
+
+/**
+ * @brief Gets the FAT entry of a virtual cluster.
+ */
+static uint32_t virtualFatEntry(uint32_t cluster) {
+	if (cluster == 0) {
+		return 0x0FFFFFF8;	// Media descriptor
+	}
+
+	if (cluster == 1) {
+		return FAT32_END_OF_CHAIN;
+	}
+
+	if (cluster < ROOT_CLUSTER + rootClusters) {
+		return cluster + 1 == ROOT_CLUSTER + rootClusters ? FAT32_END_OF_CHAIN : cluster + 1;
+	}
+
+	const virtualFile* file = findFileByCluster(cluster);
+	if (file == nullptr || cluster >= file->firstCluster + file->dataClusters) {
+		return 0;  // Free, including the room left for growing files
+	}
+
+	return cluster + 1 == file->firstCluster + file->dataClusters ? FAT32_END_OF_CHAIN : cluster + 1;
+}
+
+static void generateFatSector(uint32_t fatSector, uint8_t* sector) {
+	constexpr uint16_t entriesPerSector = VIRTUAL_SECTOR_SIZE / 4;
+
+	for (uint16_t i = 0; i < entriesPerSector; i++) {
+		write32(sector + i * 4, virtualFatEntry(fatSector * entriesPerSector + i));
+	}
+}
+
+/**
+ * @brief Makes the 8.3 alias of a file, FILE0001.CSV and so on, keeping up to 3 characters of its extension.
+ */
+static void generateShortName(size_t fileIndex, uint8_t* shortName) {
+	char base[9];
+	snprintf(base, sizeof(base), "FILE%04u", static_cast<unsigned>(fileIndex % 10000));
+	memcpy(shortName, base, 8);
+	memset(shortName + 8, ' ', 3);
+
+	const char* extension = strrchr(files[fileIndex].name, '.');
+	for (uint8_t i = 0; extension != nullptr && i < 3 && extension[i + 1] != '\0'; i++) {
+		char c = toupper(extension[i + 1]);
+		shortName[8 + i] = isalnum(c) ? c : '_';
+	}
+}
+
+static void generateDirectoryEntry(uint32_t entryIndex, uint8_t* entry) {
+	if (entryIndex == 0) {
+		memcpy(entry, VOLUME_LABEL, 11);
+		entry[11] = ATTR_VOLUME_ID;
+		return;
+	}
+
+	const virtualFile* file = findFileByEntry(entryIndex);
+	if (file == nullptr) {
+		return;
+	}
+
+	uint8_t shortName[11];
+	generateShortName(file - files.data(), shortName);
+
+	uint8_t entryInFile = entryIndex - file->firstEntry;
+
+	if (entryInFile < file->lfnEntries) {
+		// Long name entries are stored last part first
+		uint8_t order = file->lfnEntries - entryInFile;
+		uint16_t nameLength = strlen(file->name);
+
+		entry[0] = order | (order == file->lfnEntries ? 0x40 : 0);
+		entry[11] = ATTR_LONG_NAME;
+		entry[13] = shortNameChecksum(shortName);
+
+		for (uint8_t i = 0; i < LFN_CHARS_PER_ENTRY; i++) {
+			uint16_t position = (order - 1) * LFN_CHARS_PER_ENTRY + i;
+			uint16_t c = position < nameLength ? file->name[position] : (position == nameLength ? 0x0000 : 0xFFFF);
+			write16(entry + lfnCharOffsets[i], c);
+		}
+		return;
+	}
+
+	uint32_t firstCluster = file->dataClusters > 0 ? file->firstCluster : 0;
+
+	memcpy(entry, shortName, 11);
+	entry[11] = ATTR_READ_ONLY | ATTR_ARCHIVE;
+	write16(entry + 14, file->createTime);
+	write16(entry + 16, file->createDate);
+	write16(entry + 18, file->accessDate);
+	write16(entry + 20, firstCluster >> 16);
+	write16(entry + 22, file->writeTime);
+	write16(entry + 24, file->writeDate);
+	write16(entry + 26, firstCluster & 0xFFFF);
+	write32(entry + 28, file->size);
+}
+
+/**
+ * @brief Reads a sector of a file straight from the card.
+ */
+static bool readFileSector(const virtualFile& file, uint32_t fileSector, uint8_t* sector) {
+	uint32_t byteOffset = fileSector * VIRTUAL_SECTOR_SIZE;
+	if (byteOffset >= file.size) {
+		return true;
+	}
+
+	uint32_t clusterIndex = fileSector / physical.sectorsPerCluster;
+	for (const clusterRun& run : file.runs) {
+		if (clusterIndex < run.length) {
+			uint32_t cluster = run.firstCluster + clusterIndex;
+			uint32_t lba = physical.dataStart + (cluster - 2) * physical.sectorsPerCluster + fileSector % physical.sectorsPerCluster;
+
+			if (!readPhysical(lba, sector)) {
+				return false;
+			}
+
+			// Don't show whatever follows the end of the file in its last sector
+			if (file.size - byteOffset < VIRTUAL_SECTOR_SIZE) {
+				memset(sector + (file.size - byteOffset), 0, VIRTUAL_SECTOR_SIZE - (file.size - byteOffset));
+			}
+			return true;
+		}
+		clusterIndex -= run.length;
+	}
+
+	return true;
+}
+
+bool readVirtualSector(uint32_t lba, uint8_t* sector) {
+	memset(sector, 0, VIRTUAL_SECTOR_SIZE);
+
+	if (lba < RESERVED_SECTORS) {
+		uint32_t bootSector = lba >= BACKUP_BOOT_SECTOR ? lba - BACKUP_BOOT_SECTOR : lba;
+
+		if (bootSector == 0) {
+			generateBootSector(sector);
+		} else if (bootSector == FSINFO_SECTOR) {
+			generateFsInfoSector(sector);
+		}
+		return true;
+	}
+
+	if (lba < dataStart) {
+		generateFatSector((lba - RESERVED_SECTORS) % fatSectors, sector);
+		return true;
+	}
+
+	uint32_t cluster = ROOT_CLUSTER + (lba - dataStart) / sectorsPerCluster;
+	uint32_t sectorInCluster = (lba - dataStart) % sectorsPerCluster;
+
+	if (cluster < ROOT_CLUSTER + rootClusters) {
+		uint32_t firstEntry = ((cluster - ROOT_CLUSTER) * sectorsPerCluster + sectorInCluster) * DIR_ENTRIES_PER_SECTOR;
+
+		for (uint8_t i = 0; i < DIR_ENTRIES_PER_SECTOR && firstEntry + i < rootEntryCount; i++) {
+			generateDirectoryEntry(firstEntry + i, sector + i * DIR_ENTRY_SIZE);
+		}
+		return true;
+	}
+
+	const virtualFile* file = findFileByCluster(cluster);
+	if (file == nullptr || cluster >= file->firstCluster + file->dataClusters) {
+		return true;
+	}
+
+	return readFileSector(*file, (cluster - file->firstCluster) * sectorsPerCluster + sectorInCluster, sector);
+}
+
+#endif
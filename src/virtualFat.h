@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+
+// Read-only FAT32 volume synthesised from the files in the root directory of the SD card.
+//
+// The boot sector, FATs and root directory are generated on the fly when the host reads them.
+// File data sectors map straight onto the card's own sectors, so nothing is copied and the
+// host can never write to the card's file system while the firmware keeps logging to it.
+// The card itself must be FAT16 or FAT32. A card too small to hold the 65525 clusters a FAT32
+// volume needs is presented as a VIRTUAL_MIN_SECTORS volume, with the space past the card free.
+
+constexpr uint16_t VIRTUAL_SECTOR_SIZE = 512;
+constexpr uint16_t VIRTUAL_MAX_FILES = 256;
+constexpr uint32_t VIRTUAL_MIN_SECTORS = 66600;  // Room for 65525 one sector clusters after the FATs
+constexpr uint16_t VIRTUAL_GROWTH_CLUSTERS = 256;  // Room left after each growing file so appends don't move later files
+
+typedef bool (*sectorReader)(uint32_t lba, uint8_t* buffer);
+
+/**
+ * @brief Scans the card's root directory and lays out the virtual volume.
+ *
+ * Can be called again after the card's files change. Files named in growingFiles are placed
+ * last with VIRTUAL_GROWTH_CLUSTERS of room each, so the rest of the layout stays where a host
+ * that cached it expects it.
+ *
+ * @param readPhysicalSector Reads one sector of the card.
+ * @param totalSectors The size of the card in sectors. The virtual volume is at least VIRTUAL_MIN_SECTORS.
+ * @param growingFiles Names of files that are still being appended to.
+ * @param growingFileCount The number of names in growingFiles.
+ * @return True if the card's file system was understood.
+ */
+bool buildVirtualVolume(sectorReader readPhysicalSector, uint32_t totalSectors, const char* const growingFiles[], uint8_t growingFileCount);
+
+/**
+ * @brief Reads one sector of the virtual volume.
+ *
+ * @param lba The virtual sector number.
+ * @param buffer Filled with VIRTUAL_SECTOR_SIZE bytes.
+ * @return False if the underlying card read failed.
+ */
+bool readVirtualSector(uint32_t lba, uint8_t* buffer);
+
+/**
+ * @brief Gets the number of files presented on the virtual volume.
+ */
+uint16_t getVirtualFileCount();
+
+/**
+ * @brief Gets the size of the virtual volume in sectors, to announce to the host.
+ */
+uint32_t getVirtualSectorCount();
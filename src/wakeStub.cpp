@@ -0,0 +1,369 @@
+#include "wakeStub.h"
+
+#include "esp_rom_sys.h"
+#include "esp_sleep.h"
+#include "soc/gpio_reg.h"
+#include "soc/gpio_sig_map.h"
+#include "soc/io_mux_reg.h"
+#include "soc/rtc_cntl_reg.h"
+#include "soc/rtc_io_reg.h"
+
+// Only the stub and the ROM are available, so every function it calls must be in RTC fast memory
+#define ONEWIRE_PROTOCOL_ATTR RTC_IRAM_ATTR
+#include "oneWireProtocol.h"
+
+// Everything the stub touches lives in RTC slow memory. The ROM checks a CRC of RTC fast
+// memory before running the stub, so the stub must never write there.
+RTC_SLOW_ATTR wakeStubState wakeStub;
+
+// PCF8563 registers
+constexpr uint8_t PCF8563_ADDRESS = 0x51;
+constexpr uint8_t PCF8563_CONTROL_2 = 0x01;
+constexpr uint8_t PCF8563_MINUTE_ALARM = 0x09;
+constexpr uint8_t PCF8563_ALARM_FLAG = 0x08;
+constexpr uint8_t PCF8563_ALARM_INTERRUPT_ENABLE = 0x02;
+constexpr uint8_t PCF8563_ALARM_DISABLED = 0x80;
+constexpr uint8_t PCF8563_CLOCK_INVALID = 0x80;
+
+static inline void RTC_IRAM_ATTR pullLow(uint8_t pin) {
+	REG_WRITE(GPIO_ENABLE_W1TS_REG, BIT(pin));
+}
+
+static inline void RTC_IRAM_ATTR release(uint8_t pin) {
+	REG_WRITE(GPIO_ENABLE_W1TC_REG, BIT(pin));
+}
+
+static inline bool RTC_IRAM_ATTR readPin(uint8_t pin) {
+	return (REG_READ(GPIO_IN_REG) >> pin) & 1;
+}
+
+/**
+ * @brief Sets a pin up as an open drain GPIO, released so the bus pull-up holds it high.
+ */
+static void RTC_IRAM_ATTR configureOpenDrainPin(uint8_t pin) {
+	uint32_t muxRegister = IO_MUX_GPIO0_REG + pin * 4;	// The ESP32-S2 IO MUX registers are in pin order
+
+	PIN_FUNC_SELECT(muxRegister, PIN_FUNC_GPIO);
+	PIN_INPUT_ENABLE(muxRegister);
+	REG_WRITE(GPIO_FUNC0_OUT_SEL_CFG_REG + pin * 4, SIG_GPIO_OUT_IDX);
+	REG_WRITE(GPIO_OUT_W1TC_REG, BIT(pin));
+	release(pin);
+}
+
+static uint8_t RTC_IRAM_ATTR toBcd(uint8_t value) {
+	return ((value / 10) << 4) | (value % 10);
+}
+
+static uint8_t RTC_IRAM_ATTR fromBcd(uint8_t value) {
+	return (value >> 4) * 10 + (value & 0x0F);
+}
+
+// I2C at about 100 kHz
+
+static void RTC_IRAM_ATTR i2cStart() {
+	release(WIRE_SDA);
+	release(WIRE_SCL);
+	esp_rom_delay_us(5);
+	pullLow(WIRE_SDA);
+	esp_rom_delay_us(5);
+	pullLow(WIRE_SCL);
+}
+
+static void RTC_IRAM_ATTR i2cStop() {
+	pullLow(WIRE_SDA);
+	esp_rom_delay_us(5);
+	release(WIRE_SCL);
+	esp_rom_delay_us(5);
+	release(WIRE_SDA);
+	esp_rom_delay_us(5);
+}
+
+/**
+ * @brief Clocks out a byte, most significant bit first.
+ *
+ * @return True if the byte was acknowledged.
+ */
+static bool RTC_IRAM_ATTR i2cWrite(uint8_t value) {
+	for (uint8_t bit = 0; bit < 8; bit++) {
+		if (value & 0x80) {
+			release(WIRE_SDA);
+		} else {
+			pullLow(WIRE_SDA);
+		}
+		value <<= 1;
+		esp_rom_delay_us(5);
+		release(WIRE_SCL);
+		esp_rom_delay_us(5);
+		pullLow(WIRE_SCL);
+	}
+
+	release(WIRE_SDA);
+	esp_rom_delay_us(5);
+	release(WIRE_SCL);
+	esp_rom_delay_us(5);
+	bool acknowledged = !readPin(WIRE_SDA);
+	pullLow(WIRE_SCL);
+	return acknowledged;
+}
+
+static uint8_t RTC_IRAM_ATTR i2cRead(bool acknowledge) {
+	uint8_t value = 0;
+	release(WIRE_SDA);
+
+	for (uint8_t bit = 0; bit < 8; bit++) {
+		esp_rom_delay_us(5);
+		release(WIRE_SCL);
+		esp_rom_delay_us(5);
+		value = (value << 1) | readPin(WIRE_SDA);
+		pullLow(WIRE_SCL);
+	}
+
+	if (acknowledge) {
+		pullLow(WIRE_SDA);
+	}
+	esp_rom_delay_us(5);
+	release(WIRE_SCL);
+	esp_rom_delay_us(5);
+	pullLow(WIRE_SCL);
+	release(WIRE_SDA);
+	return value;
+}
+
+static bool RTC_IRAM_ATTR readClockRegisters(uint8_t firstRegister, uint8_t* values, uint8_t count) {
+	i2cStart();
+	bool ok = i2cWrite(PCF8563_ADDRESS << 1) && i2cWrite(firstRegister);
+
+	if (ok) {
+		i2cStart();
+		ok = i2cWrite((PCF8563_ADDRESS << 1) | 1);
+	}
+
+	for (uint8_t i = 0; ok && i < count; i++) {
+		values[i] = i2cRead(i + 1 < count);
+	}
+
+	i2cStop();
+	return ok;
+}
+
+static bool RTC_IRAM_ATTR writeClockRegisters(uint8_t firstRegister, const uint8_t* values, uint8_t count) {
+	i2cStart();
+	bool ok = i2cWrite(PCF8563_ADDRESS << 1) && i2cWrite(firstRegister);
+
+	for (uint8_t i = 0; ok && i < count; i++) {
+		ok = i2cWrite(values[i]);
+	}
+
+	i2cStop();
+	return ok;
+}
+
+/**
+ * @brief A OneWire bus on an open drain GPIO, for the shared protocol.
+ */
+struct stubOneWireBus {
+	uint8_t pin;
+
+	inline void RTC_IRAM_ATTR pullLow() {
+		::pullLow(pin);
+	}
+
+	inline void RTC_IRAM_ATTR release() {
+		::release(pin);
+	}
+
+	inline bool RTC_IRAM_ATTR read() {
+		return readPin(pin);
+	}
+
+	inline void RTC_IRAM_ATTR delayMicroseconds(uint32_t us) {
+		esp_rom_delay_us(us);
+	}
+};
+
+/**
+ * @brief Searches a bus and checks that it holds exactly the sensors the stub was given.
+ *
+ * @return False if a sensor was added, removed or swapped, or the search failed.
+ */
+static bool RTC_IRAM_ATTR sensorsUnchanged(stubOneWireBus& bus, const wakeStubPort& port) {
+	// Only these two fields need zeroing to start a search, and a struct initialiser may call memset in flash
+	oneWireSearchState state;
+	state.lastDiscrepancy = 0;
+	state.done = false;
+
+	uint8_t rom[8];
+	uint8_t found = 0;
+
+	while (found <= port.sensorCount && oneWireSearch(bus, state, rom)) {
+		bool known = false;
+		for (uint8_t sensorIndex = 0; sensorIndex < port.sensorCount && !known; sensorIndex++) {
+			known = true;
+			for (uint8_t i = 0; i < 8; i++) {
+				known = known && rom[i] == port.addresses[sensorIndex][i];
+			}
+		}
+
+		if (!known) {
+			return false;
+		}
+		found++;
+	}
+
+	// A search that stops before the last device failed, unless nothing answered the reset
+	return found == port.sensorCount && (state.done || found == 0);
+}
+
+/**
+ * @brief Takes a sample if the RTC alarm alone woke the chip.
+ *
+ * @return True if the sample was stored and the next alarm set, so the chip can sleep again.
+ */
+static bool RTC_IRAM_ATTR recordSample() {
+	uint32_t wakePins = REG_GET_FIELD(RTC_CNTL_EXT_WAKEUP1_STATUS_REG, RTC_CNTL_EXT_WAKEUP1_STATUS);
+
+	if (wakePins != BIT(wakeStub.alarmPin) || wakeStub.sampleCount >= WAKE_STUB_SAMPLE_COUNT) {
+		return false;
+	}
+
+	configureOpenDrainPin(WIRE_SDA);
+	configureOpenDrainPin(WIRE_SCL);
+
+	// Control 2, then seconds to years
+	uint8_t clock[8];
+	if (!readClockRegisters(PCF8563_CONTROL_2, clock, sizeof(clock)) || !(clock[0] & PCF8563_ALARM_FLAG) || (clock[1] & PCF8563_CLOCK_INVALID)) {
+		return false;
+	}
+
+	wakeStubRecord& record = wakeStub.records[wakeStub.sampleCount];
+	uint8_t minute = fromBcd(clock[2] & 0x7F);
+	record.time = ((((fromBcd(clock[7]) * 16 + fromBcd(clock[6] & 0x1F)) * 32 + fromBcd(clock[4] & 0x3F)) * 32 + fromBcd(clock[3] & 0x3F)) * 64) + minute;
+
+	// Every few samples check that no sensor has been plugged in, unplugged or swapped since the full boot scanned the busses
+	if (wakeStub.sampleCount % WAKE_STUB_SEARCH_INTERVAL == WAKE_STUB_SEARCH_INTERVAL - 1) {
+		for (uint8_t portIndex = 0; portIndex < WAKE_STUB_PORT_COUNT; portIndex++) {
+			stubOneWireBus bus = {wakeStub.ports[portIndex].pin};
+			configureOpenDrainPin(bus.pin);
+
+			if (!sensorsUnchanged(bus, wakeStub.ports[portIndex])) {
+				return false;
+			}
+		}
+	}
+
+	for (uint8_t portIndex = 0; portIndex < WAKE_STUB_PORT_COUNT; portIndex++) {
+		const wakeStubPort& port = wakeStub.ports[portIndex];
+
+		if (port.sensorCount == 0) {
+			continue;
+		}
+
+		stubOneWireBus bus = {port.pin};
+		configureOpenDrainPin(port.pin);
+
+		for (uint8_t sensorIndex = 0; sensorIndex < port.sensorCount; sensorIndex++) {
+			if (!readDS18B20(bus, port.addresses[sensorIndex], record.raw[portIndex * WAKE_STUB_SENSORS_PER_PORT + sensorIndex])) {
+				return false;
+			}
+		}
+
+		// Convert while asleep so the reading is ready at the next wake
+		if (!startDS18B20Conversion(bus)) {
+			return false;
+		}
+	}
+
+	// The same next alarm as nextAlarmMinute(), which is in flash, only the minute alarm enabled
+	uint8_t alarmMinute = minute + wakeStub.intervalMins - (minute % wakeStub.intervalMins);
+	if (alarmMinute >= 60) {
+		alarmMinute = 0;
+	}
+
+	const uint8_t alarm[] = {toBcd(alarmMinute), PCF8563_ALARM_DISABLED, PCF8563_ALARM_DISABLED, PCF8563_ALARM_DISABLED};
+	const uint8_t control = PCF8563_ALARM_INTERRUPT_ENABLE;	 // Clears the alarm flag
+
+	if (!writeClockRegisters(PCF8563_MINUTE_ALARM, alarm, sizeof(alarm)) || !writeClockRegisters(PCF8563_CONTROL_2, &control, 1)) {
+		return false;
+	}
+
+	// The interrupt pin must have dropped or the chip would wake straight away
+	esp_rom_delay_us(10);
+	if ((REG_READ(RTC_GPIO_IN_REG) >> (RTC_GPIO_IN_NEXT_S + wakeStub.alarmPin)) & 1) {
+		return false;
+	}
+
+	wakeStub.sampleCount++;
+	return true;
+}
+
+/**
+ * @brief Goes back into deep sleep with the wake sources set before the last full boot.
+ */
+static void RTC_IRAM_ATTR sleepAgain() {
+	REG_SET_BIT(RTC_CNTL_EXT_WAKEUP1_REG, RTC_CNTL_EXT_WAKEUP1_STATUS_CLR);
+	REG_WRITE(RTC_ENTRY_ADDR_REG, reinterpret_cast<uint32_t>(&esp_wake_deep_sleep));
+
+	CLEAR_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_SLEEP_EN);
+	SET_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_SLEEP_EN);
+
+	// Sleep starts within a few cycles
+	while (true) {
+	}
+}
+
+void RTC_IRAM_ATTR esp_wake_deep_sleep(void) {
+	if (wakeStub.armed && recordSample()) {
+		sleepAgain();
+	}
+
+	esp_default_wake_deep_sleep();
+}
+
+void armWakeStub(const wakeStubPort ports[WAKE_STUB_PORT_COUNT], uint8_t alarmPin, uint8_t intervalMins) {
+	memcpy(wakeStub.ports, ports, sizeof(wakeStub.ports));
+	wakeStub.alarmPin = alarmPin;
+	wakeStub.intervalMins = intervalMins;
+	wakeStub.armed = intervalMins > 0;
+}
+
+void disarmWakeStub() {
+	wakeStub.armed = false;
+}
+
+uint8_t getWakeStubSampleCount() {
+	return min(wakeStub.sampleCount, WAKE_STUB_SAMPLE_COUNT);
+}
+
+bool getWakeStubSample(uint8_t index, wakeStubSample& sample) {
+	if (index >= getWakeStubSampleCount()) {
+		return false;
+	}
+
+	const wakeStubRecord& record = wakeStub.records[index];
+	sample.minute = record.time % 64;
+	sample.hour = (record.time / 64) % 32;
+	sample.day = (record.time / (64 * 32)) % 32;
+	sample.month = (record.time / (64 * 32 * 32)) % 16;
+	sample.year = 2000 + record.time / (64 * 32 * 32 * 16);
+
+	for (uint8_t sensor = 0; sensor < WAKE_STUB_SENSOR_COUNT; sensor++) {
+		sample.temperatures[sensor] = record.raw[sensor] / 16.0f;
+	}
+
+	return true;
+}
+
+void clearWakeStubSamples() {
+	wakeStub.sampleCount = 0;
+}
+
+void dropWakeStubSamples(uint8_t count) {
+	uint8_t sampleCount = getWakeStubSampleCount();
+	if (count >= sampleCount) {
+		clearWakeStubSamples();
+		return;
+	}
+
+	memmove(wakeStub.records, wakeStub.records + count, (sampleCount - count) * sizeof(wakeStubRecord));
+	wakeStub.sampleCount = sampleCount - count;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Deep sleep wake stub that logs a sample without booting.
+//
+// When the RTC alarm is the only wake source, the stub runs straight from RTC fast memory:
+// it reads the temperatures the sensors converted before the last sleep, stores them with
+// the PCF8563 time in RTC memory, starts the next conversion, sets the next alarm and goes
+// back to sleep. The OneWire and I2C busses are bit-banged because none of the drivers are
+// available before boot.
+//
+// Every WAKE_STUB_SEARCH_INTERVAL samples the stub also runs a ROM search on each bus, about
+// 14 ms per sensor, and boots if the sensors found are not the ones it was given, so a sensor
+// plugged into a bus is picked up by the full boot's scan within the hour.
+//
+// Any other wake source, a full buffer, a changed or missing sensor, a bad CRC or an I2C error
+// boots as normal instead, and the full boot writes the buffered samples to the log.
+
+constexpr uint8_t WAKE_STUB_PORT_COUNT = 3;
+constexpr uint8_t WAKE_STUB_SENSORS_PER_PORT = 5;
+constexpr uint8_t WAKE_STUB_SENSOR_COUNT = WAKE_STUB_PORT_COUNT * WAKE_STUB_SENSORS_PER_PORT;
+constexpr uint8_t WAKE_STUB_SAMPLE_COUNT = 24;	// 6 hours at 15 minute intervals between full boots
+constexpr uint8_t WAKE_STUB_SEARCH_INTERVAL = 4;	// Hourly at 15 minute intervals
+
+// A OneWire bus as the stub sees it
+struct wakeStubPort {
+	uint8_t pin;
+	uint8_t sensorCount;
+	uint8_t addresses[WAKE_STUB_SENSORS_PER_PORT][8];
+};
+
+// A sample as the stub stored it
+struct wakeStubRecord {
+	uint32_t time;							// PCF8563 date and time packed by the stub, UTC
+	int16_t raw[WAKE_STUB_SENSOR_COUNT];	// DS18B20 readings in 1/16 of a degree
+};
+
+// A stored sample unpacked for logging
+struct wakeStubSample {
+	uint16_t year;
+	uint8_t month;
+	uint8_t day;
+	uint8_t hour;
+	uint8_t minute;
+	float temperatures[WAKE_STUB_SENSOR_COUNT];	 // Sensor slot, port index * 5 + sensor index
+};
+
+// The stub's configuration and buffer, kept in RTC slow memory
+struct wakeStubState {
+	bool armed;
+	uint8_t alarmPin;
+	uint8_t intervalMins;
+	uint8_t sampleCount;
+	wakeStubPort ports[WAKE_STUB_PORT_COUNT];
+	wakeStubRecord records[WAKE_STUB_SAMPLE_COUNT];
+};
+
+/**
+ * @brief Lets the stub handle the next RTC alarm wakes.
+ *
+ * Call just before deep sleep, after the sensors have been told to start converting.
+ *
+ * @param ports The sensors on each OneWire bus.
+ * @param alarmPin The GPIO connected to the PCF8563 interrupt output, high while the alarm is set.
+ * @param intervalMins The recording interval the stub sets the next alarm with.
+ */
+void armWakeStub(const wakeStubPort ports[WAKE_STUB_PORT_COUNT], uint8_t alarmPin, uint8_t intervalMins);
+
+/**
+ * @brief Makes every wake boot as normal.
+ */
+void disarmWakeStub();
+
+/**
+ * @brief Gets the number of samples the stub has stored.
+ */
+uint8_t getWakeStubSampleCount();
+
+/**
+ * @brief Unpacks a stored sample, oldest first.
+ *
+ * @param index 0 for the oldest sample.
+ * @param sample Filled with the sample.
+ * @return False if there is no such sample.
+ */
+bool getWakeStubSample(uint8_t index, wakeStubSample& sample);
+
+/**
+ * @brief Discards every stored sample, for a new recording.
+ */
+void clearWakeStubSamples();
+
+/**
+ * @brief Discards the oldest samples once they have been logged, keeping the rest in order.
+ *
+ * @param count How many samples were logged.
+ */
+void dropWakeStubSamples(uint8_t count);
@@ -0,0 +1,65 @@
+"""Post-link check that everything kept through deep sleep fits in RTC slow memory.
+
+Reads the section sizes and addresses of the linked firmware with the toolchain's size tool and
+adds up the RTC slow memory sections: .rtc.data and .rtc.bss (RTC_DATA_ATTR), .rtc_noinit
+(RTC_NOINIT_ATTR) and .rtc.force_slow (RTC_SLOW_ATTR), including variables in libraries and the
+padding between them. Prints the total after every build and fails the build if a section ends
+past the end of RTC slow memory. The part reserved for the ULP coprocessor is at the start of
+the memory, before .rtc.data, so it is never counted as free.
+
+Usage: extra_scripts = post:tools/checkRtcSize.py in platformio.ini, which runs it after linking
+Or: python3 checkRtcSize.py <size tool> <firmware.elf>
+"""
+
+import subprocess
+import sys
+
+RTC_SLOW_SECTIONS = (".rtc.data", ".rtc.bss", ".rtc_noinit", ".rtc.force_slow")
+RTC_SLOW_START = 0x50000000  # ESP32-S2 RTC slow memory, as the CPU's data bus sees it
+RTC_SLOW_END = RTC_SLOW_START + 8192
+
+
+def read_sections(size_tool, elf):
+    """Returns {name: (size, address)} from `size -A -d`."""
+    output = subprocess.run([size_tool, "-A", "-d", elf], check=True, capture_output=True, text=True).stdout
+    sections = {}
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) == 3 and fields[1].isdigit() and fields[2].isdigit():
+            sections[fields[0]] = (int(fields[1]), int(fields[2]))
+    return sections
+
+
+def check(size_tool, elf):
+    """Prints the RTC slow memory use of the ELF and returns False if it does not fit."""
+    sections = read_sections(size_tool, elf)
+    slow = {name: sections[name] for name in RTC_SLOW_SECTIONS if name in sections and RTC_SLOW_START <= sections[name][1] < RTC_SLOW_END}
+
+    if not slow:
+        print("RTC slow memory: no RTC slow sections in %s" % elf)
+        return True
+
+    start = min(address for size, address in slow.values())
+    end = max(address + size for size, address in slow.values())
+    parts = ", ".join("%s %u" % (name, size) for name, (size, address) in slow.items())
+    print("RTC slow memory: %u of %u bytes (%s)" % (end - start, RTC_SLOW_END - start, parts))
+
+    if end > RTC_SLOW_END:
+        print("RTC slow memory: %u bytes over, move RTC_DATA_ATTR state to ordinary RAM or make it smaller" % (end - RTC_SLOW_END))
+        return False
+    return True
+
+
+try:
+    Import("env")  # noqa: F821, defined when PlatformIO runs this as an extra script
+
+    def check_after_link(target, source, env):
+        if not check(env.subst("$SIZETOOL"), str(target[0])):
+            env.Exit(1)
+
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", check_after_link)  # noqa: F821
+except NameError:
+    if __name__ == "__main__":
+        if len(sys.argv) != 3:
+            sys.exit(__doc__)
+        sys.exit(0 if check(sys.argv[1], sys.argv[2]) else 1)
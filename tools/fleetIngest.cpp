@@ -0,0 +1,993 @@
+// Merges KeaRecorder log files copied from many SD cards into one time-aligned CSV per unit.
+//
+// Every *.csv log under the input directory is grouped by the "Unit ID" line the firmware writes
+// at the top of each file, or by the serial number in the file name for logs written before that
+// line existed. Units are merged on a pool of threads, one at a time per thread, so a fleet larger
+// than memory only needs its largest unit to fit. Each log is memory-mapped and parsed without
+// copying. Each unit gets <output directory>/<unit>.csv in the same format as a log, with one row
+// per logged minute and one column per sensor seen on any of its logs.
+//
+// Rows are keyed on UTC, from the local time and UTC offset columns, so the hour repeated when
+// the clocks go back stays two hours of rows. Rows logged more than once, for example by copying
+// the same card twice, are merged into one. Sensors are keyed on their whole ROM code. Logs
+// written before the offset column existed are taken to be at --legacy-offset, +0000 by default,
+// and a sensor they name by its 4 character screen name shares the column of the one ROM code
+// from the unit's newer logs that it matches.
+//
+// With --summaries each unit also gets <unit>_summary.csv, the hourly and daily rows the firmware
+// writes next to each log, rebuilt from the merged rows. With --check-summaries each log's
+// rows are summarised again on their own and compared with the _summary.csv the firmware wrote
+// next to it, and the exit status is 1 if any row differs. The figures are computed exactly,
+// with integer sums of the logged tenths, so they check the firmware's running statistics.
+//
+// The header's fixed columns come from src/logFormat.h, so a change to the firmware's header is
+// picked up on the next build. A log whose header matches neither it nor the legacy header is
+// reported and its rows are counted as unreadable.
+//
+// Build: g++ -O2 -std=c++17 -pthread -Isrc tools/fleetIngest.cpp -o fleetIngest
+// Usage: fleetIngest [--legacy-offset <+HHMM>] [--summaries] [--check-summaries] <input directory> <output directory> [threads]
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "logFormat.h"
+
+namespace fs = std::filesystem;
+
+constexpr int16_t VALUE_MISSING = INT16_MIN;	  // No reading for the sensor in this row
+constexpr int16_t VALUE_ERROR = INT16_MIN + 1;  // The sensor logged ERR
+constexpr uint16_t BATTERY_MISSING = 0;
+constexpr const char* UNIT_ID_PREFIX = "Unit ID,";
+constexpr const char* HEADER_PREFIX = "Date(";
+constexpr const char* LEGACY_HEADER_FIXED_COLUMNS = "Date(YYYY-MM-DD),Time(HH:MM),Battery(mV)";	 // Before the offset column
+constexpr size_t ROM_CODE_LENGTH = 16;
+constexpr size_t SCREEN_NAME_LENGTH = 4;
+constexpr const char* SUMMARY_SUFFIX = "_summary.csv";
+constexpr uint8_t SUMMARY_DIFFERENCES_SHOWN = 5;  // Per summary file
+
+// UTC offset in minutes given to rows from logs without an offset column
+static int16_t legacyOffset = 0;
+static bool writeSummaries = false;
+static bool checkSummaries = false;
+
+// Rows logged under one header line, stored column by column
+struct logSession {
+	std::vector<std::string> sensors;
+	bool hasOffset = false;			// The rows have a UTC offset column
+	std::vector<int32_t> minutes;	// Minutes since 1970 UTC
+	std::vector<int16_t> offsets;	// Minutes the local time the row was logged in is ahead of UTC
+	std::vector<uint16_t> battery;
+	std::vector<int16_t> values;	// Tenths of a degree, row-major: minutes.size() x sensors.size()
+};
+
+struct logFile {
+	fs::path path;
+	std::string unit;
+	std::vector<logSession> sessions;
+	uint64_t bytes = 0;
+	uint32_t badLines = 0;
+};
+
+struct unitStats {
+	size_t logs = 0;
+	uint64_t bytes = 0;
+	uint32_t badLines = 0;
+	size_t rows = 0;
+	size_t duplicateRows = 0;
+	size_t conflicts = 0;  // Cells logged twice with different values
+	size_t summaryRowsChecked = 0;
+	size_t summaryRowsDiffering = 0;
+};
+
+// One sensor over one hour or day, as a summary row holds it
+struct summaryStats {
+	uint32_t count = 0;
+	uint32_t errors = 0;
+	int64_t sum = 0;  // Tenths, so the mean and deviation are exact
+	int64_t sumOfSquares = 0;
+	int16_t minimum = 0;
+	int16_t maximum = 0;
+	int32_t minimumAt = 0;	// Minutes into the period
+	int32_t maximumAt = 0;
+};
+
+// Summary rows keyed on the period's local start in minutes, the period and the sensor name
+typedef std::map<std::tuple<int32_t, uint8_t, std::string>, summaryStats> summaryTable;
+
+/**
+ * @brief Counts the days from 1970-01-01 to a civil date.
+ */
+static int32_t daysFromCivil(int32_t year, uint32_t month, uint32_t day) {
+	year -= month <= 2;
+	int32_t era = (year >= 0 ? year : year - 399) / 400;
+	uint32_t yearOfEra = static_cast<uint32_t>(year - era * 400);
+	uint32_t dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+	uint32_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+	return era * 146097 + static_cast<int32_t>(dayOfEra) - 719468;
+}
+
+/**
+ * @brief Converts days since 1970-01-01 back to a civil date.
+ */
+static void civilFromDays(int32_t days, int32_t& year, uint32_t& month, uint32_t& day) {
+	days += 719468;
+	int32_t era = (days >= 0 ? days : days - 146096) / 146097;
+	uint32_t dayOfEra = static_cast<uint32_t>(days - era * 146097);
+	uint32_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+	uint32_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+	uint32_t monthIndex = (5 * dayOfYear + 2) / 153;
+	day = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+	month = monthIndex < 10 ? monthIndex + 3 : monthIndex - 9;
+	year = static_cast<int32_t>(yearOfEra) + era * 400 + (month <= 2);
+}
+
+/**
+ * @brief Reads an unsigned number of exactly `digits` digits.
+ */
+static bool parseDigits(const char*& cursor, const char* end, uint8_t digits, uint32_t& value) {
+	value = 0;
+	for (uint8_t i = 0; i < digits; i++) {
+		if (cursor >= end || *cursor < '0' || *cursor > '9') {
+			return false;
+		}
+		value = value * 10 + (*cursor++ - '0');
+	}
+	return true;
+}
+
+/**
+ * @brief Reads "YYYY-MM-DD,HH:MM" as minutes since 1970.
+ */
+static bool parseTimestamp(const char*& cursor, const char* end, int32_t& minutes) {
+	uint32_t year, month, day, hour, minute;
+
+	if (!parseDigits(cursor, end, 4, year) || cursor == end || *cursor++ != '-' ||
+		!parseDigits(cursor, end, 2, month) || cursor == end || *cursor++ != '-' ||
+		!parseDigits(cursor, end, 2, day) || cursor == end || *cursor++ != ',' ||
+		!parseDigits(cursor, end, 2, hour) || cursor == end || *cursor++ != ':' ||
+		!parseDigits(cursor, end, 2, minute)) {
+		return false;
+	}
+
+	if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59) {
+		return false;
+	}
+
+	minutes = daysFromCivil(year, month, day) * 1440 + hour * 60 + minute;
+	return true;
+}
+
+/**
+ * @brief Reads a UTC offset such as "+1200" or "-0500" as minutes.
+ */
+static bool parseOffset(const char* cursor, const char* end, int16_t& minutes) {
+	uint32_t hours, remainder;
+
+	if (end - cursor != 5 || (*cursor != '+' && *cursor != '-')) {
+		return false;
+	}
+
+	bool negative = *cursor++ == '-';
+	if (!parseDigits(cursor, end, 2, hours) || !parseDigits(cursor, end, 2, remainder) || hours > 23 || remainder > 59) {
+		return false;
+	}
+
+	minutes = static_cast<int16_t>(hours * 60 + remainder);
+	minutes = negative ? -minutes : minutes;
+	return true;
+}
+
+/**
+ * @brief Reads a temperature such as "21.5", "-0.5" or "ERR" as tenths of a degree.
+ */
+static int16_t parseTemperature(const char* cursor, const char* end) {
+	if (cursor == end) {
+		return VALUE_MISSING;
+	}
+
+	if (end - cursor == 3 && memcmp(cursor, "ERR", 3) == 0) {
+		return VALUE_ERROR;
+	}
+
+	bool negative = *cursor == '-';
+	cursor += negative;
+
+	int32_t whole = 0;
+	int32_t tenths = 0;
+	bool digits = false;
+
+	while (cursor < end && *cursor >= '0' && *cursor <= '9') {
+		whole = std::min(whole * 10 + (*cursor++ - '0'), 100000);
+		digits = true;
+	}
+
+	if (cursor < end && *cursor == '.') {
+		cursor++;
+		if (cursor < end && *cursor >= '0' && *cursor <= '9') {
+			tenths = *cursor++ - '0';
+			digits = true;
+		}
+		while (cursor < end && *cursor >= '0' && *cursor <= '9') {
+			cursor++;
+		}
+	}
+
+	if (!digits || cursor != end) {
+		return VALUE_MISSING;
+	}
+
+	int32_t value = whole * 10 + tenths;
+	value = negative ? -value : value;
+	return static_cast<int16_t>(std::clamp<int32_t>(value, VALUE_ERROR + 1, INT16_MAX));
+}
+
+/**
+ * @brief Splits a line into comma separated cells without copying.
+ */
+static void splitCells(const char* line, const char* end, std::vector<std::pair<const char*, const char*>>& cells) {
+	cells.clear();
+	const char* start = line;
+
+	for (const char* cursor = line; cursor <= end; cursor++) {
+		if (cursor == end || *cursor == ',') {
+			cells.emplace_back(start, cursor);
+			start = cursor + 1;
+		}
+	}
+}
+
+/**
+ * @brief Gets the unit a legacy log belongs to from the serial number in its name, /2023-Jun-23-2041_C8.csv.
+ */
+static std::string unitFromFileName(const fs::path& path) {
+	std::string stem = path.stem().string();
+	size_t underscore = stem.rfind('_');
+	return "serial-" + (underscore == std::string::npos ? stem : stem.substr(underscore + 1));
+}
+
+/**
+ * @brief Makes a unit ID safe to name an output file with.
+ */
+static void sanitiseUnit(std::string& unit) {
+	for (char& c : unit) {
+		c = isalnum(static_cast<unsigned char>(c)) || c == '-' ? c : '_';
+	}
+}
+
+/**
+ * @brief Gets the unit a log belongs to from its first line, or from its name if it has no Unit ID line.
+ */
+static std::string readUnit(const fs::path& path) {
+	std::string unit;
+	char start[128];
+	size_t length = 0;
+
+	FILE* file = fopen(path.c_str(), "rb");
+	if (file != nullptr) {
+		length = fread(start, 1, sizeof(start), file);
+		fclose(file);
+	}
+
+	size_t prefixLength = strlen(UNIT_ID_PREFIX);
+	if (length > prefixLength && memcmp(start, UNIT_ID_PREFIX, prefixLength) == 0) {
+		char* lineEnd = static_cast<char*>(memchr(start, '\n', length));
+		unit.assign(start + prefixLength, lineEnd ? lineEnd : start + length);
+		if (!unit.empty() && unit.back() == '\r') {
+			unit.pop_back();
+		}
+	}
+
+	if (unit.empty()) {
+		unit = unitFromFileName(path);
+	}
+	sanitiseUnit(unit);
+	return unit;
+}
+
+/**
+ * @brief Counts the comma separated columns in a header.
+ */
+static constexpr size_t countColumns(const char* header) {
+	size_t columns = 1;
+	for (; *header != '\0'; header++) {
+		columns += *header == ',';
+	}
+	return columns;
+}
+
+// Rows are parsed as the date and time, the offset, the battery and then the sensors
+static_assert(countColumns(LOG_HEADER_FIXED_COLUMNS) == 4, "The log header's fixed columns changed, update parseLog");
+static_assert(countColumns(LEGACY_HEADER_FIXED_COLUMNS) == 3, "Legacy rows are the date and time, the battery and then the sensors");
+
+/**
+ * @brief Whether a header line starts with the given fixed columns, followed by the sensors or nothing.
+ */
+static bool startsWithColumns(const char* line, size_t length, const char* columns) {
+	size_t columnsLength = strlen(columns);
+	return length >= columnsLength && memcmp(line, columns, columnsLength) == 0 && (length == columnsLength || line[columnsLength] == ',');
+}
+
+/**
+ * @brief Parses one memory-mapped log file.
+ */
+static void parseLog(logFile& log, const char* data, size_t size) {
+	const char* end = data + size;
+	logSession* session = nullptr;
+	std::vector<std::pair<const char*, const char*>> cells;
+
+	for (const char* line = data; line < end;) {
+		const char* lineEnd = static_cast<const char*>(memchr(line, '\n', end - line));
+		const char* next = lineEnd ? lineEnd + 1 : end;
+		lineEnd = lineEnd ? lineEnd : end;
+		if (lineEnd > line && lineEnd[-1] == '\r') {
+			lineEnd--;
+		}
+
+		size_t length = lineEnd - line;
+
+		if (length == 0) {
+			// Blank line
+		} else if (length > strlen(UNIT_ID_PREFIX) && memcmp(line, UNIT_ID_PREFIX, strlen(UNIT_ID_PREFIX)) == 0) {
+			// Already read by readUnit
+		} else if (length >= strlen(HEADER_PREFIX) && memcmp(line, HEADER_PREFIX, strlen(HEADER_PREFIX)) == 0) {
+			bool hasOffset = startsWithColumns(line, length, LOG_HEADER_FIXED_COLUMNS);
+
+			if (!hasOffset && !startsWithColumns(line, length, LEGACY_HEADER_FIXED_COLUMNS)) {
+				fprintf(stderr, "%s: unrecognised header \"%.*s\"\n", log.path.c_str(), static_cast<int>(std::min<size_t>(length, 80)), line);
+				session = nullptr;
+				log.badLines++;
+			} else {
+				splitCells(line, lineEnd, cells);
+				session = &log.sessions.emplace_back();
+				session->hasOffset = hasOffset;
+				for (size_t column = countColumns(hasOffset ? LOG_HEADER_FIXED_COLUMNS : LEGACY_HEADER_FIXED_COLUMNS); column < cells.size(); column++) {
+					session->sensors.emplace_back(cells[column].first, cells[column].second);
+				}
+			}
+		} else if (session != nullptr) {
+			const char* cursor = line;
+			int32_t minutes;
+			int16_t offset = legacyOffset;
+
+			// Cells after the time: the offset if the log has one, the battery, then the sensors
+			size_t batteryCell = session->hasOffset ? 1 : 0;
+
+			bool valid = parseTimestamp(cursor, lineEnd, minutes) && cursor != lineEnd && *cursor == ',';
+			if (valid) {
+				splitCells(cursor + 1, lineEnd, cells);
+				valid = cells.size() > batteryCell && (!session->hasOffset || parseOffset(cells[0].first, cells[0].second, offset));
+			}
+
+			if (!valid) {
+				log.badLines++;
+			} else {
+				uint32_t battery = 0;
+				const char* batteryCursor = cells[batteryCell].first;
+				while (batteryCursor < cells[batteryCell].second && *batteryCursor >= '0' && *batteryCursor <= '9') {
+					battery = std::min(battery * 10 + (*batteryCursor++ - '0'), static_cast<uint32_t>(UINT16_MAX));
+				}
+
+				session->minutes.push_back(minutes - offset);
+				session->offsets.push_back(offset);
+				session->battery.push_back(batteryCursor == cells[batteryCell].second ? battery : BATTERY_MISSING);
+
+				for (size_t sensor = 0; sensor < session->sensors.size(); sensor++) {
+					size_t cell = batteryCell + 1 + sensor;
+					session->values.push_back(cell < cells.size() ? parseTemperature(cells[cell].first, cells[cell].second) : VALUE_MISSING);
+				}
+			}
+		} else {
+			log.badLines++;
+		}
+
+		line = next;
+	}
+}
+
+/**
+ * @brief Memory-maps and parses a log file.
+ */
+static void loadLog(logFile& log) {
+	int descriptor = open(log.path.c_str(), O_RDONLY);
+	if (descriptor < 0) {
+		fprintf(stderr, "Can't open %s\n", log.path.c_str());
+		return;
+	}
+
+	struct stat info;
+	if (fstat(descriptor, &info) == 0 && info.st_size > 0) {
+		void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+
+		if (data != MAP_FAILED) {
+			madvise(data, info.st_size, MADV_SEQUENTIAL);
+			log.bytes = info.st_size;
+			parseLog(log, static_cast<const char*>(data), info.st_size);
+			munmap(data, info.st_size);
+		} else {
+			fprintf(stderr, "Can't map %s\n", log.path.c_str());
+		}
+	}
+
+	close(descriptor);
+}
+
+/**
+ * @brief Appends a number of at least `width` digits to a line, padding with zeros.
+ */
+static void appendNumber(std::string& line, uint32_t value, uint8_t width = 1) {
+	char digits[10];
+	uint8_t count = 0;
+
+	do {
+		digits[count++] = '0' + value % 10;
+		value /= 10;
+	} while (value > 0 || count < width);
+
+	while (count > 0) {
+		line += digits[--count];
+	}
+}
+
+/**
+ * @brief Appends tenths of a degree as "21.5" to a line.
+ */
+static void appendTenths(std::string& line, int16_t tenths) {
+	if (tenths < 0) {
+		line += '-';
+	}
+
+	uint32_t magnitude = tenths < 0 ? -tenths : tenths;
+	appendNumber(line, magnitude / 10);
+	line += '.';
+	line += static_cast<char>('0' + magnitude % 10);
+}
+
+/**
+ * @brief Divides rounding towards negative infinity, so times before 1970 fall in the right period.
+ */
+static int32_t floorDivide(int32_t value, int32_t divisor) {
+	return value >= 0 ? value / divisor : (value - divisor + 1) / divisor;
+}
+
+/**
+ * @brief Adds a logged cell to the hour and day it was logged in, the same way the firmware's summaries do.
+ *
+ * @param localMinutes The local time of the row in minutes since 1970.
+ */
+static void addToSummaries(summaryTable& table, int32_t localMinutes, const std::string& sensor, int16_t value) {
+	if (value == VALUE_MISSING) {
+		return;
+	}
+
+	for (uint8_t period = 0; period < SUMMARY_PERIOD_COUNT; period++) {
+		int32_t length = summaryPeriodSeconds[period] / 60;
+		int32_t start = floorDivide(localMinutes, length) * length;
+		summaryStats& stats = table[{start, period, sensor}];
+
+		if (value == VALUE_ERROR) {
+			stats.errors++;
+			continue;
+		}
+
+		// The first time each extreme is seen
+		if (stats.count == 0 || value < stats.minimum) {
+			stats.minimum = value;
+			stats.minimumAt = localMinutes - start;
+		}
+		if (stats.count == 0 || value > stats.maximum) {
+			stats.maximum = value;
+			stats.maximumAt = localMinutes - start;
+		}
+
+		stats.count++;
+		stats.sum += value;
+		stats.sumOfSquares += static_cast<int64_t>(value) * value;
+	}
+}
+
+/**
+ * @brief The sample standard deviation in tenths, 0 for fewer than two readings.
+ */
+static double standardDeviation(const summaryStats& stats) {
+	if (stats.count < 2) {
+		return 0;
+	}
+	double squares = stats.sumOfSquares - static_cast<double>(stats.sum) * stats.sum / stats.count;
+	return std::sqrt(std::max(0.0, squares) / (stats.count - 1));
+}
+
+/**
+ * @brief Formats local minutes since 1970 as "YYYY-MM-DD HH:MM", or only "HH:MM".
+ */
+static std::string formatLocalMinutes(int32_t minutes, bool withDate) {
+	int32_t days = floorDivide(minutes, 1440);
+	int32_t minuteOfDay = minutes - days * 1440;
+	int32_t year;
+	uint32_t month, day;
+	civilFromDays(days, year, month, day);
+
+	char text[48];
+	if (withDate) {
+		snprintf(text, sizeof(text), "%04d-%02u-%02u %02d:%02d", year, month, day, minuteOfDay / 60, minuteOfDay % 60);
+	} else {
+		snprintf(text, sizeof(text), "%02d:%02d", minuteOfDay / 60, minuteOfDay % 60);
+	}
+	return text;
+}
+
+/**
+ * @brief Writes summary rows in the firmware's format, oldest period first.
+ */
+static void writeSummaryFile(const summaryTable& table, const fs::path& path) {
+	std::string output = std::string(SUMMARY_HEADER) + "\r\n";
+	char cells[96];
+
+	for (const auto& [key, stats] : table) {
+		const auto& [start, period, sensor] = key;
+		output += std::string(summaryPeriodNames[period]) + ',' + formatLocalMinutes(start, true) + ',' + sensor + ',' + std::to_string(stats.count);
+
+		if (stats.count > 0) {
+			snprintf(cells, sizeof(cells), ",%.2f,%.2f,%.1f,%s,%.1f,%s", stats.sum / 10.0 / stats.count, standardDeviation(stats) / 10, stats.minimum / 10.0,
+					 formatLocalMinutes(start + stats.minimumAt, false).c_str(), stats.maximum / 10.0, formatLocalMinutes(start + stats.maximumAt, false).c_str());
+			output += cells;
+		} else {
+			output += ",,,,,,";
+		}
+		output += ',' + std::to_string(stats.errors) + "\r\n";
+	}
+
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == nullptr || fwrite(output.data(), 1, output.size(), file) != output.size()) {
+		fprintf(stderr, "Can't write %s\n", path.c_str());
+	}
+	if (file != nullptr) {
+		fclose(file);
+	}
+}
+
+/**
+ * @brief Whether a summary cell holds a number within tolerance of the expected value.
+ */
+static bool cellMatches(const std::string& cell, double expected, double tolerance) {
+	char* end;
+	double value = strtod(cell.c_str(), &end);
+	return !cell.empty() && *end == '\0' && std::fabs(value - expected) <= tolerance;
+}
+
+/**
+ * @brief Compares the summary file the firmware wrote next to a log with that log's own rows summarised again.
+ *
+ * Every row in the file must match, except that the mean and standard deviation, which the
+ * firmware prints to two places from a float running total, may be out by one in the last place.
+ * Periods still open when the card was copied have no row in the file yet, so they are not checked.
+ */
+static void checkSummaryFile(const logFile& log, const fs::path& path, unitStats& stats) {
+	summaryTable table;
+	for (const logSession& session : log.sessions) {
+		for (size_t row = 0; row < session.minutes.size(); row++) {
+			int32_t localMinutes = session.minutes[row] + session.offsets[row];
+			for (size_t sensor = 0; sensor < session.sensors.size(); sensor++) {
+				addToSummaries(table, localMinutes, session.sensors[sensor], session.values[row * session.sensors.size() + sensor]);
+			}
+		}
+	}
+
+	FILE* file = fopen(path.c_str(), "rb");
+	if (file == nullptr) {
+		fprintf(stderr, "Can't open %s\n", path.c_str());
+		return;
+	}
+
+	std::vector<std::pair<const char*, const char*>> cells;
+	std::map<std::tuple<int32_t, uint8_t, std::string>, uint32_t> seen;
+	char line[256];
+	uint32_t differences = 0;
+
+	while (fgets(line, sizeof(line), file) != nullptr) {
+		size_t length = strcspn(line, "\r\n");
+		if (length == 0 || strncmp(line, SUMMARY_HEADER, length) == 0) {
+			continue;
+		}
+
+		splitCells(line, line + length, cells);
+		std::vector<std::string> text;
+		for (const auto& [first, last] : cells) {
+			text.emplace_back(first, last);
+		}
+
+		const char* problem = nullptr;
+		uint8_t period = 0;
+		while (period < SUMMARY_PERIOD_COUNT && (text.empty() || text[0] != summaryPeriodNames[period])) {
+			period++;
+		}
+
+		// The start reads like a log row's date and time with a space for the comma
+		int32_t start = 0;
+		std::string startCells = text.size() > 1 ? text[1] : "";
+		std::replace(startCells.begin(), startCells.end(), ' ', ',');
+		const char* cursor = startCells.c_str();
+
+		if (text.size() != 11 || period == SUMMARY_PERIOD_COUNT || !parseTimestamp(cursor, startCells.c_str() + startCells.size(), start)) {
+			problem = "unreadable row";
+		} else if (seen[{start, period, text[2]}]++ > 0) {
+			problem = "period written twice";
+		} else {
+			auto expected = table.find({start, period, text[2]});
+			summaryStats none;
+			const summaryStats& want = expected == table.end() ? none : expected->second;
+
+			if (text[3] != std::to_string(want.count)) {
+				problem = "count";
+			} else if (text[10] != std::to_string(want.errors)) {
+				problem = "errors";
+			} else if (want.count > 0 && !cellMatches(text[4], want.sum / 10.0 / want.count, 0.011)) {
+				problem = "mean";
+			} else if (want.count > 0 && !cellMatches(text[5], standardDeviation(want) / 10, 0.011)) {
+				problem = "standard deviation";
+			} else if (want.count > 0 && (parseTemperature(text[6].data(), text[6].data() + text[6].size()) != want.minimum ||
+										  text[7] != formatLocalMinutes(start + want.minimumAt, false))) {
+				problem = "minimum";
+			} else if (want.count > 0 && (parseTemperature(text[8].data(), text[8].data() + text[8].size()) != want.maximum ||
+										  text[9] != formatLocalMinutes(start + want.maximumAt, false))) {
+				problem = "maximum";
+			}
+		}
+
+		stats.summaryRowsChecked++;
+		if (problem != nullptr) {
+			stats.summaryRowsDiffering++;
+			if (differences++ < SUMMARY_DIFFERENCES_SHOWN) {
+				fprintf(stderr, "%s: %s differs from the log: %.*s\n", path.c_str(), problem, static_cast<int>(length), line);
+			}
+		}
+	}
+
+	fclose(file);
+}
+
+/**
+ * @brief Merges every session of a unit into time-aligned rows and writes them to its output file.
+ */
+static unitStats writeUnit(const std::string& unit, const std::vector<const logFile*>& logs, const fs::path& outputDirectory) {
+	unitStats stats;
+
+	// One column per sensor, in the order first seen
+	std::vector<std::string> sensors;
+	std::map<std::string, uint32_t> columns;
+
+	struct rowRef {
+		int32_t minutes;
+		const logSession* session;
+		const std::vector<uint32_t>* columns;  // Output column of each of the session's sensors
+		uint32_t row;
+	};
+	std::vector<rowRef> rows;
+	std::vector<std::vector<uint32_t>> sessionColumns;
+
+	size_t sessionCount = 0;
+	for (const logFile* log : logs) {
+		sessionCount += log->sessions.size();
+	}
+	sessionColumns.reserve(sessionCount);  // Rows point into it
+
+	// A legacy screen name is the high digit of ROM bytes 1, 3, 5 and 7, so it shares the column of the one ROM code that matches it
+	std::map<std::string, std::string> screenNames;
+	for (const logFile* log : logs) {
+		for (const logSession& session : log->sessions) {
+			for (const std::string& sensor : session.sensors) {
+				if (sensor.size() == ROM_CODE_LENGTH) {
+					std::string name = {sensor[2], sensor[6], sensor[10], sensor[14]};
+					auto [match, added] = screenNames.emplace(name, sensor);
+					if (!added && match->second != sensor) {
+						match->second.clear();	// Two sensors share the name, so it can't be told which one a legacy log meant
+					}
+				}
+			}
+		}
+	}
+
+	for (const logFile* log : logs) {
+		for (const logSession& session : log->sessions) {
+			std::vector<uint32_t>& map = sessionColumns.emplace_back();
+
+			for (const std::string& name : session.sensors) {
+				auto match = name.size() == SCREEN_NAME_LENGTH ? screenNames.find(name) : screenNames.end();
+				const std::string& sensor = match != screenNames.end() && !match->second.empty() ? match->second : name;
+
+				auto [column, added] = columns.emplace(sensor, sensors.size());
+				if (added) {
+					sensors.push_back(sensor);
+				}
+				map.push_back(column->second);
+			}
+
+			for (uint32_t row = 0; row < session.minutes.size(); row++) {
+				rows.push_back({session.minutes[row], &session, &map, row});
+			}
+		}
+	}
+
+	std::stable_sort(rows.begin(), rows.end(), [](const rowRef& a, const rowRef& b) { return a.minutes < b.minutes; });
+
+	std::string output = std::string(UNIT_ID_PREFIX) + unit + "\r\n" + LOG_HEADER_FIXED_COLUMNS;
+	for (const std::string& sensor : sensors) {
+		output += ',' + sensor;
+	}
+	output += "\r\n";
+
+	std::vector<int16_t> merged(sensors.size());
+	summaryTable summaries;
+
+	for (size_t first = 0; first < rows.size();) {
+		size_t last = first;
+		uint16_t battery = BATTERY_MISSING;
+		std::fill(merged.begin(), merged.end(), VALUE_MISSING);
+
+		// Rows logged in the same minute are the same reading copied more than once
+		for (; last < rows.size() && rows[last].minutes == rows[first].minutes; last++) {
+			const logSession& session = *rows[last].session;
+			const std::vector<uint32_t>& map = *rows[last].columns;
+
+			if (battery == BATTERY_MISSING) {
+				battery = session.battery[rows[last].row];
+			}
+
+			for (size_t sensor = 0; sensor < map.size(); sensor++) {
+				int16_t value = session.values[rows[last].row * map.size() + sensor];
+				int16_t& cell = merged[map[sensor]];
+
+				if (cell == VALUE_MISSING || cell == VALUE_ERROR) {
+					cell = value == VALUE_MISSING ? cell : value;
+				} else if (value != VALUE_MISSING && value != VALUE_ERROR && value != cell) {
+					stats.conflicts++;
+				}
+			}
+		}
+
+		stats.duplicateRows += last - first - 1;
+		stats.rows++;
+
+		// Written in the local time and offset of the oldest log's copy
+		int16_t offset = rows[first].session->offsets[rows[first].row];
+		int32_t year;
+		uint32_t month, day;
+		int32_t minutes = rows[first].minutes + offset;
+		int32_t days = minutes >= 0 ? minutes / 1440 : (minutes - 1439) / 1440;
+		int32_t minuteOfDay = minutes - days * 1440;
+		civilFromDays(days, year, month, day);
+
+		appendNumber(output, year, 4);
+		output += '-';
+		appendNumber(output, month, 2);
+		output += '-';
+		appendNumber(output, day, 2);
+		output += ',';
+		appendNumber(output, minuteOfDay / 60, 2);
+		output += ':';
+		appendNumber(output, minuteOfDay % 60, 2);
+		output += offset < 0 ? ",-" : ",+";
+		appendNumber(output, std::abs(offset) / 60 * 100 + std::abs(offset) % 60, 4);
+		output += ',';
+		if (battery != BATTERY_MISSING) {
+			appendNumber(output, battery);
+		}
+
+		if (writeSummaries) {
+			for (size_t sensor = 0; sensor < sensors.size(); sensor++) {
+				addToSummaries(summaries, minutes, sensors[sensor], merged[sensor]);
+			}
+		}
+
+		for (int16_t value : merged) {
+			output += ',';
+			if (value == VALUE_ERROR) {
+				output += "ERR";
+			} else if (value != VALUE_MISSING) {
+				appendTenths(output, value);
+			}
+		}
+		output += "\r\n";
+
+		first = last;
+	}
+
+	fs::path path = outputDirectory / (unit + ".csv");
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == nullptr || fwrite(output.data(), 1, output.size(), file) != output.size()) {
+		fprintf(stderr, "Can't write %s\n", path.c_str());
+	}
+	if (file != nullptr) {
+		fclose(file);
+	}
+
+	if (writeSummaries) {
+		writeSummaryFile(summaries, outputDirectory / (unit + SUMMARY_SUFFIX));
+	}
+
+	return stats;
+}
+
+/**
+ * @brief Runs a job for every index from 0 to count on a pool of threads.
+ */
+template <typename Job>
+static void parallelFor(size_t count, unsigned threadCount, Job job) {
+	std::atomic<size_t> next{0};
+	std::vector<std::thread> threads;
+
+	for (unsigned thread = 0; thread < threadCount; thread++) {
+		threads.emplace_back([&]() {
+			for (size_t index = next++; index < count; index = next++) {
+				job(index);
+			}
+		});
+	}
+
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+}
+
+/**
+ * @brief Loads every log of a unit, merges them and writes the unit's output file, then frees the logs.
+ */
+static unitStats mergeUnit(const std::string& unit, std::vector<logFile>& logs, const fs::path& outputDirectory) {
+	for (logFile& log : logs) {
+		loadLog(log);
+	}
+
+	// Oldest first, so sensor columns come out in the order they were fitted
+	std::vector<const logFile*> loaded;
+	for (const logFile& log : logs) {
+		if (!log.sessions.empty()) {
+			loaded.push_back(&log);
+		}
+	}
+
+	std::sort(loaded.begin(), loaded.end(), [](const logFile* a, const logFile* b) {
+		auto firstMinute = [](const logFile* log) {
+			for (const logSession& session : log->sessions) {
+				if (!session.minutes.empty()) {
+					return session.minutes.front();
+				}
+			}
+			return INT32_MAX;
+		};
+		return firstMinute(a) < firstMinute(b);
+	});
+
+	unitStats stats = loaded.empty() ? unitStats{} : writeUnit(unit, loaded, outputDirectory);
+	stats.logs = loaded.size();
+
+	if (checkSummaries) {
+		for (const logFile* log : loaded) {
+			fs::path summaryPath = log->path;
+			summaryPath.replace_filename(log->path.stem().string() + SUMMARY_SUFFIX);
+			if (fs::exists(summaryPath)) {
+				checkSummaryFile(*log, summaryPath, stats);
+			}
+		}
+	}
+	for (const logFile& log : logs) {
+		stats.bytes += log.bytes;
+		stats.badLines += log.badLines;
+	}
+
+	logs.clear();
+	logs.shrink_to_fit();
+	return stats;
+}
+
+int main(int argc, char** argv) {
+	int argument = 1;
+	for (; argument < argc && strncmp(argv[argument], "--", 2) == 0; argument++) {
+		if (strcmp(argv[argument], "--summaries") == 0) {
+			writeSummaries = true;
+		} else if (strcmp(argv[argument], "--check-summaries") == 0) {
+			checkSummaries = true;
+		} else if (strcmp(argv[argument], "--legacy-offset") == 0 && argument + 1 < argc) {
+			argument++;
+			if (!parseOffset(argv[argument], argv[argument] + strlen(argv[argument]), legacyOffset)) {
+				fprintf(stderr, "Bad offset %s, expected +HHMM or -HHMM\n", argv[argument]);
+				return 1;
+			}
+		} else {
+			break;
+		}
+	}
+
+	if (argc - argument < 2) {
+		fprintf(stderr, "Usage: %s [--legacy-offset <+HHMM>] [--summaries] [--check-summaries] <input directory> <output directory> [threads]\n", argv[0]);
+		return 1;
+	}
+
+	fs::path inputDirectory = argv[argument];
+	fs::path outputDirectory = argv[argument + 1];
+	unsigned threadCount = argc > argument + 2 ? std::max(1, atoi(argv[argument + 2])) : std::max(1u, std::thread::hardware_concurrency());
+	auto startTime = std::chrono::steady_clock::now();
+
+	// Collect the logs, leaving out the summary files written next to them
+	std::vector<logFile> logs;
+	std::error_code error;
+	for (auto it = fs::recursive_directory_iterator(inputDirectory, fs::directory_options::skip_permission_denied, error); it != fs::recursive_directory_iterator(); it.increment(error)) {
+		const fs::path& path = it->path();
+		std::string name = path.filename().string();
+
+		size_t suffixLength = strlen(SUMMARY_SUFFIX);
+		bool summary = name.size() >= suffixLength && name.compare(name.size() - suffixLength, suffixLength, SUMMARY_SUFFIX) == 0;
+
+		if (it->is_regular_file() && path.extension() == ".csv" && !summary) {
+			logs.emplace_back().path = path;
+		}
+	}
+
+	if (error) {
+		fprintf(stderr, "Can't read %s: %s\n", inputDirectory.c_str(), error.message().c_str());
+		return 1;
+	}
+
+	// Group the logs by unit from their first lines, before reading any of them whole
+	parallelFor(logs.size(), threadCount, [&](size_t index) { logs[index].unit = readUnit(logs[index].path); });
+
+	std::map<std::string, std::vector<logFile>> units;
+	for (logFile& log : logs) {
+		units[log.unit].push_back(std::move(log));
+	}
+	logs.clear();
+
+	fs::create_directories(outputDirectory, error);
+
+	std::vector<std::pair<const std::string*, std::vector<logFile>*>> unitList;
+	for (auto& [unit, unitLogs] : units) {
+		unitList.emplace_back(&unit, &unitLogs);
+	}
+
+	std::vector<unitStats> stats(unitList.size());
+	parallelFor(unitList.size(), threadCount, [&](size_t index) { stats[index] = mergeUnit(*unitList[index].first, *unitList[index].second, outputDirectory); });
+
+	size_t logCount = 0;
+	uint64_t totalBytes = 0;
+	uint32_t badLines = 0;
+	size_t summaryRowsDiffering = 0;
+
+	for (size_t index = 0; index < unitList.size(); index++) {
+		logCount += stats[index].logs;
+		totalBytes += stats[index].bytes;
+		badLines += stats[index].badLines;
+
+		if (stats[index].logs > 0) {
+			printf("%s: %zu logs, %zu rows, %zu duplicate rows merged, %zu conflicting cells\n", unitList[index].first->c_str(), stats[index].logs,
+				   stats[index].rows, stats[index].duplicateRows, stats[index].conflicts);
+		}
+
+		if (checkSummaries && stats[index].summaryRowsChecked > 0) {
+			printf("%s: %zu summary rows checked, %zu differ from the logs\n", unitList[index].first->c_str(), stats[index].summaryRowsChecked,
+				   stats[index].summaryRowsDiffering);
+		}
+		summaryRowsDiffering += stats[index].summaryRowsDiffering;
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	printf("%zu logs, %.1f MB, %u unreadable lines, %u threads, %.2f s, %.1f MB/s\n", logCount, totalBytes / 1e6, badLines,
+		   threadCount, seconds, totalBytes / 1e6 / seconds);
+
+	return summaryRowsDiffering > 0 ? 1 : 0;
+}
@@ -0,0 +1,360 @@
+// Host microbenchmarks for the log and screen text functions in src/logFormat.cpp.
+//
+// Of the wake path's functions, getCurrentDateTime() and the arithmetic of setupNextAlarm(),
+// nextAlarmMinute(), are timed here. The rest of setupNextAlarm() is I2C writes to the PCF8563,
+// which only exist on the device. The date and time are formatted in the firmware's time zone.
+//
+// Reports for each function the time per call, the heap allocations per call and the bytes of
+// code and constants it links to. Sizes come from a GNU ld link map: by default the map this
+// binary was linked with, or the firmware's own map given with --map, since host x86 code is only
+// a proxy for Xtensa flash.
+//
+// Each round times every function between two runs of a fixed integer loop, and a function's
+// cost is the median over the rounds of its time divided by the loop's. That ratio holds on a
+// slower or busier machine than the one that wrote the baseline, where raw times don't. With
+// --check the results are compared with a baseline file and the exit status is 1 if a function's
+// cost rose by more than the cost tolerance, it allocates more or it grew by more than the size
+// tolerance. The tolerances are stored in the baseline, 1.5 and 1.10 unless --write was given
+// others, and --cost-tolerance and --size-tolerance override them for one run.
+//
+// Build: g++ -O2 -std=c++17 -ffunction-sections -fdata-sections -Wl,--gc-sections -Wl,-Map,logFormatBench.map -Isrc tools/logFormatBench.cpp src/logFormat.cpp -o logFormatBench
+// Usage: logFormatBench [--map <link map>] [--check <baseline> | --write <baseline>] [--cost-tolerance <ratio>] [--size-tolerance <ratio>]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "logFormat.h"
+
+constexpr double DEFAULT_COST_TOLERANCE = 1.5;
+constexpr double DEFAULT_SIZE_TOLERANCE = 1.10;
+constexpr const char* TIME_ZONE = "CST6CDT,M3.2.0,M11.1.0";	 // time_zone in src/main.cpp
+constexpr double ROUND_NS = 5e6;  // Each timing makes enough calls to take about 5 ms
+constexpr uint8_t ROUNDS = 31;
+
+// Every heap allocation, whether from malloc or new
+static uint64_t allocations = 0;
+
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* pointer, size_t size);
+
+extern "C" void* malloc(size_t size) {
+	allocations++;
+	return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) {
+	allocations++;
+	return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* pointer, size_t size) {
+	allocations++;
+	return __libc_realloc(pointer, size);
+}
+
+void* operator new(size_t size) {
+	void* pointer = malloc(size);
+	if (pointer == nullptr) {
+		throw std::bad_alloc();
+	}
+	return pointer;
+}
+
+void operator delete(void* pointer) noexcept {
+	free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+	free(pointer);
+}
+
+// A function under test, called with an index to pick its input with
+struct benchmark {
+	const char* name;
+	std::function<uint32_t(uint32_t)> call;
+	std::vector<const char*> sections;	// Link map section names that make up its size, including tables only it uses
+	uint32_t calls = 0;					// Per timing
+	std::vector<double> ns = {};
+	std::vector<double> costs = {};
+	uint64_t allocations = 0;
+};
+
+struct benchResult {
+	double nsPerCall;
+	double cost;  // Time relative to the reference loop
+	double allocationsPerCall;
+	uint32_t bytes;
+};
+
+// Keeps the results alive so the calls aren't optimised away
+static volatile uint32_t sink;
+
+/**
+ * @brief The same work in every version of the code, to measure the machine's speed against.
+ */
+static uint32_t referenceLoop(uint32_t i) {
+	uint32_t state = i | 1;
+	for (uint8_t step = 0; step < 64; step++) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+	}
+	return state;
+}
+
+static double timeCalls(const std::function<uint32_t(uint32_t)>& call, uint32_t calls) {
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < calls; i++) {
+		sink = sink + call(i);
+	}
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / calls;
+}
+
+static double median(std::vector<double> values) {
+	std::sort(values.begin(), values.end());
+	return values[values.size() / 2];
+}
+
+/**
+ * @brief Sums the input sections of a GNU ld link map that hold a function's code and constants.
+ *
+ * Sections are matched by name, which -ffunction-sections and -fdata-sections give each function
+ * and table, so ".text._Z12formatTenthsPci" and Xtensa's ".literal._Z12formatTenthsPci" both count.
+ */
+static uint32_t readLinkMapSize(const std::string& path, const std::vector<const char*>& names) {
+	uint32_t bytes = 0;
+	std::ifstream map(path);
+	std::string line;
+	std::string section;
+
+	while (std::getline(map, line)) {
+		std::istringstream fields(line);
+		std::string first;
+		fields >> first;
+
+		// A long section name is alone on its line, with the address and size on the next
+		if (line.size() > 1 && line[0] == ' ' && line[1] == '.') {
+			section = first;
+			if (!(fields >> first)) {
+				continue;
+			}
+		} else if (section.empty() || first.compare(0, 2, "0x") != 0) {
+			section.clear();
+			continue;
+		}
+
+		std::string size;
+		fields >> size;
+		bool flash = section.compare(0, 6, ".text.") == 0 || section.compare(0, 9, ".literal.") == 0 || section.compare(0, 8, ".rodata.") == 0;
+
+		for (const char* name : names) {
+			if (flash && section.find(name) != std::string::npos && size.compare(0, 2, "0x") == 0) {
+				bytes += strtoul(size.c_str(), nullptr, 16);
+			}
+		}
+		section.clear();
+	}
+
+	return bytes;
+}
+
+// Allowed growth before --check fails, as ratios of the baseline
+struct tolerances {
+	double cost = DEFAULT_COST_TOLERANCE;
+	double size = DEFAULT_SIZE_TOLERANCE;
+};
+
+static std::map<std::string, benchResult> readBaseline(const std::string& path, tolerances& limits) {
+	std::map<std::string, benchResult> baseline;
+	std::ifstream file(path);
+	std::string line;
+
+	while (std::getline(file, line)) {
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+
+		std::istringstream fields(line);
+		std::string name;
+		benchResult result;
+		if (line.compare(0, 10, "tolerance ") == 0) {
+			fields >> name >> limits.cost >> limits.size;
+		} else if (fields >> name >> result.nsPerCall >> result.cost >> result.allocationsPerCall >> result.bytes) {
+			baseline[name] = result;
+		}
+	}
+
+	return baseline;
+}
+
+int main(int argc, char** argv) {
+	std::string mapPath = "logFormatBench.map";
+	std::string checkPath;
+	std::string writePath;
+	double costTolerance = 0;  // 0 until given, to use the baseline's
+	double sizeTolerance = 0;
+
+	for (int i = 1; i + 1 < argc; i += 2) {
+		if (strcmp(argv[i], "--map") == 0) {
+			mapPath = argv[i + 1];
+		} else if (strcmp(argv[i], "--check") == 0) {
+			checkPath = argv[i + 1];
+		} else if (strcmp(argv[i], "--write") == 0) {
+			writePath = argv[i + 1];
+		} else if (strcmp(argv[i], "--cost-tolerance") == 0) {
+			costTolerance = atof(argv[i + 1]);
+		} else if (strcmp(argv[i], "--size-tolerance") == 0) {
+			sizeTolerance = atof(argv[i + 1]);
+		} else {
+			fprintf(stderr, "Usage: %s [--map <link map>] [--check <baseline> | --write <baseline>] [--cost-tolerance <ratio>] [--size-tolerance <ratio>]\n",
+					argv[0]);
+			return 2;
+		}
+	}
+
+	setenv("TZ", TIME_ZONE, 1);
+	tzset();
+
+	// Inputs cycle through realistic values so nothing is constant folded
+	std::vector<int32_t> tenths;
+	for (int32_t value = -550; value <= 1250; value += 7) {
+		tenths.push_back(value);
+	}
+	tenths.push_back(-1270);  // DEVICE_DISCONNECTED_C
+
+	constexpr size_t addressCount = 16;
+	uint8_t addresses[addressCount][8];
+	for (size_t i = 0; i < addressCount; i++) {
+		for (uint8_t byte = 0; byte < 8; byte++) {
+			addresses[i][byte] = static_cast<uint8_t>(0x28 + i * 37 + byte * 101);
+		}
+	}
+
+	std::vector<logReading> readings;
+	for (uint8_t i = 0; i < 15; i++) {
+		readings.push_back({-12.5f + i * 3.0625f, i == 7});
+	}
+
+	char text[256];
+	std::vector<benchmark> benchmarks = {
+		{"formatTenths", [&](uint32_t i) { return static_cast<uint32_t>(formatTenths(text, tenths[i % tenths.size()])); }, {"formatTenths"}},
+		{"calculateBatteryPercentage", [&](uint32_t i) { return static_cast<uint32_t>(calculateBatteryPercentage(3000 + i % 1300)[0]); },
+		 {"calculateBatteryPercentage", "batteryDischargeCurve"}},
+		{"deviceAddressTo4Char", [&](uint32_t i) { return static_cast<uint32_t>(deviceAddressTo4Char(addresses[i % addressCount])[0]); },
+		 {"deviceAddressTo4Char"}},
+		{"formatLogLine",
+		 [&](uint32_t i) {
+			 readings[0].temperature = (i % 400) * 0.0625f;	 // A different line each call
+			 return static_cast<uint32_t>(formatLogLine(text, sizeof(text), "2023-06-23,20:41,+1200", 3700 + i % 500, readings.data(), readings.size()));
+		 },
+		 {"formatLogLine"}},
+		{"formatDateTime",
+		 [&](uint32_t i) {
+			 return static_cast<uint32_t>(formatDateTime(1687509660 + static_cast<time_t>(i) * 900, LOG_DATE_TIME_FORMAT)[15]);  // 15 minute steps
+		 },
+		 {"formatDateTime"}},
+		{"getCurrentDateTime", [&](uint32_t) { return static_cast<uint32_t>(getCurrentDateTime(LOG_DATE_TIME_FORMAT)[15]); }, {"getCurrentDateTime", "formatDateTime"}},
+		{"nextAlarmMinute", [&](uint32_t i) { return static_cast<uint32_t>(nextAlarmMinute(i % 60, 1 + i % 30)); }, {"nextAlarmMinute"}},
+	};
+
+	// Warm up and size each timing
+	uint32_t referenceCalls = std::max(1000.0, ROUND_NS / timeCalls(referenceLoop, 1000));
+	for (benchmark& bench : benchmarks) {
+		bench.calls = std::max(1000.0, ROUND_NS / timeCalls(bench.call, 1000));
+	}
+
+	std::vector<double> referenceNs;
+	for (uint8_t round = 0; round < ROUNDS; round++) {
+		for (benchmark& bench : benchmarks) {
+			double before = timeCalls(referenceLoop, referenceCalls);
+
+			uint64_t allocationsBefore = allocations;
+			double ns = timeCalls(bench.call, bench.calls);
+			bench.allocations += allocations - allocationsBefore;
+
+			double after = timeCalls(referenceLoop, referenceCalls);
+			bench.ns.push_back(ns);
+			bench.costs.push_back(ns * 2 / (before + after));
+			referenceNs.push_back(before);
+		}
+	}
+
+	std::vector<std::pair<std::string, benchResult>> results;
+	results.push_back({"reference", {median(referenceNs), 1, 0, 0}});
+
+	for (const benchmark& bench : benchmarks) {
+		double allocationsPerCall = static_cast<double>(bench.allocations) / (static_cast<double>(bench.calls) * ROUNDS);
+		results.push_back({bench.name, {median(bench.ns), median(bench.costs), allocationsPerCall, readLinkMapSize(mapPath, bench.sections)}});
+	}
+
+	printf("%-28s %10s %8s %12s %8s\n", "Function", "ns/call", "cost", "allocs/call", "bytes");
+	for (const auto& result : results) {
+		const benchResult& value = result.second;
+		printf("%-28s %10.1f %8.3f %12.2f %8u\n", result.first.c_str(), value.nsPerCall, value.cost, value.allocationsPerCall, value.bytes);
+	}
+
+	if (!writePath.empty()) {
+		FILE* file = fopen(writePath.c_str(), "w");
+		if (file == nullptr) {
+			fprintf(stderr, "Can't write %s\n", writePath.c_str());
+			return 2;
+		}
+
+		fprintf(file, "# Written by tools/logFormatBench.cpp: function, ns/call, cost relative to the reference loop, allocs/call, bytes\n");
+		fprintf(file, "# Allowed cost and size ratios for --check\n");
+		fprintf(file, "tolerance %.2f %.2f\n", costTolerance > 0 ? costTolerance : DEFAULT_COST_TOLERANCE, sizeTolerance > 0 ? sizeTolerance : DEFAULT_SIZE_TOLERANCE);
+		for (const auto& result : results) {
+			const benchResult& value = result.second;
+			fprintf(file, "%s %.1f %.3f %.2f %u\n", result.first.c_str(), value.nsPerCall, value.cost, value.allocationsPerCall, value.bytes);
+		}
+		fclose(file);
+	}
+
+	if (checkPath.empty()) {
+		return 0;
+	}
+
+	tolerances limits;
+	std::map<std::string, benchResult> baseline = readBaseline(checkPath, limits);
+	limits.cost = costTolerance > 0 ? costTolerance : limits.cost;
+	limits.size = sizeTolerance > 0 ? sizeTolerance : limits.size;
+	unsigned regressions = 0;
+
+	for (const auto& result : results) {
+		auto expected = baseline.find(result.first);
+		if (expected == baseline.end()) {
+			printf("NEW  %s has no baseline\n", result.first.c_str());
+			continue;
+		}
+
+		const benchResult& now = result.second;
+		const benchResult& before = expected->second;
+		bool slower = now.cost > before.cost * limits.cost;
+		bool allocates = now.allocationsPerCall > before.allocationsPerCall + 0.005;
+		bool larger = now.bytes > before.bytes * limits.size;
+
+		if (slower || allocates || larger) {
+			printf("FAIL %s: cost %.3f (baseline %.3f), %.2f allocs (baseline %.2f), %u bytes (baseline %u)\n", result.first.c_str(), now.cost, before.cost,
+				   now.allocationsPerCall, before.allocationsPerCall, now.bytes, before.bytes);
+			regressions++;
+		}
+	}
+
+	printf("%s: %u regressions against %s, cost tolerance %.2f, size tolerance %.2f\n", regressions == 0 ? "PASS" : "FAIL", regressions, checkPath.c_str(),
+		   limits.cost, limits.size);
+	return regressions == 0 ? 0 : 1;
+}
@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+"""Stand-in collector for the Wi-Fi offload, for testing on a local network.
+
+Appends each batch a unit POSTs to <directory>/<unit ID>/<log file name> and answers with the
+number of bytes of that file it now holds, the offset the unit resumes from. A batch whose
+X-Offset is not the end of the stored file is refused with 409 and the stored length, so
+repeated or out of order batches are never written twice. Requests are served on threads, so
+each file has a lock held from the offset check to the end of the append.
+
+Usage: python3 offloadCollector.py [directory] [port]
+Then build the firmware with OFFLOAD_URL set to "http://<this computer's address>:<port>/".
+"""
+
+import os
+import re
+import sys
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+directory = sys.argv[1] if len(sys.argv) > 1 else "offloaded"
+port = int(sys.argv[2]) if len(sys.argv) > 2 else 8080
+
+
+file_locks = {}
+file_locks_lock = threading.Lock()
+
+
+def file_lock(path):
+    """Gets the lock for one stored file, creating it on first use."""
+    with file_locks_lock:
+        return file_locks.setdefault(path, threading.Lock())
+
+
+def safe_name(name):
+    """Keeps names from escaping the collector's directory."""
+    return re.sub(r"[^A-Za-z0-9._-]", "_", name or "").lstrip(".") or "unknown"
+
+
+class CollectorHandler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"  # Keep the connection open between batches
+
+    def reply(self, status, offset):
+        body = str(offset).encode()
+        self.send_response(status)
+        self.send_header("Content-Type", "text/plain")
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def do_POST(self):
+        started = time.monotonic()
+        length = int(self.headers.get("Content-Length", 0))
+        batch = self.rfile.read(length)
+
+        unit_directory = os.path.join(directory, safe_name(self.headers.get("X-Unit-Id")))
+        path = os.path.join(unit_directory, safe_name(self.headers.get("X-File")))
+        os.makedirs(unit_directory, exist_ok=True)
+
+        try:
+            offset = int(self.headers.get("X-Offset", ""))
+        except ValueError:
+            offset = -1
+
+        # Two requests for one file, such as a retry racing the original, must not both pass the check
+        with file_lock(path):
+            stored = os.path.getsize(path) if os.path.exists(path) else 0
+
+            if offset == stored:
+                with open(path, "ab") as file:
+                    file.write(batch)
+                    file.flush()
+                    os.fsync(file.fileno())
+
+        if offset != stored:
+            self.reply(409, stored)
+            return
+
+        elapsed = time.monotonic() - started
+        print(f"{path}: {length} bytes at {offset} ({length / max(elapsed, 1e-6) / 1e3:.0f} kB/s)")
+        self.reply(200, stored + length)
+
+    def log_message(self, format, *args):
+        pass  # do_POST prints a line per batch
+
+
+if __name__ == "__main__":
+    print(f"Collecting into {os.path.abspath(directory)} on port {port}")
+    ThreadingHTTPServer(("", port), CollectorHandler).serve_forever()
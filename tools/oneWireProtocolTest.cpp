@@ -0,0 +1,391 @@
+// Host test for the bit-banged OneWire and DS18B20 protocol in src/oneWireProtocol.h.
+//
+// Runs the protocol against a simulated line with DS18B20s on it, modelled at the level of time
+// slots: each sensor decodes the master's reset and write slots from how long the line was held
+// low, answers resets with a presence pulse and holds the line low for its 0 bits in read slots.
+// The simulation also checks the master's timing against the datasheet limits. Cases cover reset
+// and presence, SEARCH ROM over several sensors, CRC failures and conversions read with MATCH ROM.
+//
+// Build: g++ -O2 -std=c++17 -Isrc tools/oneWireProtocolTest.cpp -o oneWireProtocolTest
+// Usage: oneWireProtocolTest
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <array>
+#include <set>
+#include <vector>
+
+#include "oneWireProtocol.h"
+
+// DS18B20 and bus timing limits in microseconds
+constexpr uint32_t RESET_LOW_MIN = 480;
+constexpr uint32_t PRESENCE_DELAY = 30;	 // From the end of the reset pulse, 15 to 60 on a real sensor
+constexpr uint32_t PRESENCE_LENGTH = 120;	 // 60 to 240 on a real sensor
+constexpr uint32_t WRITE_ONE_LOW_MAX = 15;
+constexpr uint32_t WRITE_ZERO_LOW_MIN = 60;
+constexpr uint32_t WRITE_ZERO_LOW_MAX = 120;
+constexpr uint32_t READ_ZERO_HOLD = 30;  // How long after the slot starts a sensor holds the line low for a 0
+constexpr uint32_t SLOT_MIN = 60;
+constexpr uint32_t RECOVERY_MIN = 1;
+
+typedef std::array<uint8_t, 8> romCode;
+
+struct testCase {
+	const char* name;
+	unsigned failures = 0;
+
+	void check(bool condition, const char* format, ...) __attribute__((format(printf, 3, 4))) {
+		if (!condition) {
+			va_list arguments;
+			va_start(arguments, format);
+			printf("  FAIL %s: ", name);
+			vprintf(format, arguments);
+			printf("\n");
+			va_end(arguments);
+			failures++;
+		}
+	}
+};
+
+// A DS18B20 on the simulated line
+struct simulatedSensor {
+	enum protocolState { idle, romCommand, matchRom, searchRom, functionCommand, sending };
+
+	romCode rom;
+	uint8_t scratchpad[DS18B20_SCRATCHPAD_SIZE];
+	int16_t nextRaw;  // What the next conversion stores, in 1/16 of a degree
+
+	// Where the sensor is in the current transaction
+	protocolState state = idle;
+	uint8_t receivedByte = 0;
+	uint8_t receivedBits = 0;
+	uint8_t romIndex = 0;
+	bool selected = false;
+	uint8_t searchBit = 0;
+	uint8_t searchPhase = 0;  // 0 sending the bit, 1 sending its complement, 2 reading the master's choice
+	uint8_t transmitBit = 0;
+	uint8_t transmitLength = 0;
+
+	simulatedSensor(const romCode& code, int16_t raw) : rom(code), nextRaw(raw) {
+		// Power on contents: 85 degrees, alarms 75 and 70, 12 bit resolution
+		const uint8_t powerOn[DS18B20_SCRATCHPAD_SIZE] = {0x50, 0x05, 0x4B, 0x46, 0x7F, 0xFF, 0x0C, 0x10, 0};
+		memcpy(scratchpad, powerOn, sizeof(scratchpad));
+		scratchpad[8] = dallasCrc8(scratchpad, 8);
+	}
+
+	bool romBit(uint8_t bit) const {
+		return (rom[bit / 8] >> (bit % 8)) & 1;
+	}
+
+	bool scratchpadBit(uint8_t bit) const {
+		return (scratchpad[bit / 8] >> (bit % 8)) & 1;
+	}
+
+	/**
+	 * @brief Whether the sensor holds the line low for the read slot that just started.
+	 */
+	bool drivesZero() {
+		if (state == searchRom && searchPhase < 2) {
+			bool bit = romBit(searchBit);
+			return searchPhase == 0 ? !bit : bit;
+		}
+
+		if (state == sending) {
+			bool bit = scratchpadBit(transmitBit++);
+			if (transmitBit == transmitLength * 8) {
+				state = idle;
+			}
+			return !bit;
+		}
+
+		return false;
+	}
+
+	/**
+	 * @brief Takes a bit the master wrote.
+	 */
+	void receiveBit(bool bit) {
+		if (state == searchRom) {
+			if (searchPhase < 2) {
+				searchPhase++;	// The end of a read slot the sensor sent in
+			} else {
+				// Sensors whose bit was not chosen drop out until the next reset
+				state = bit == romBit(searchBit) ? (++searchBit == 64 ? functionCommand : searchRom) : idle;
+				searchPhase = 0;
+			}
+			return;
+		}
+
+		if (state != romCommand && state != matchRom && state != functionCommand) {
+			return;
+		}
+
+		receivedByte |= bit << receivedBits;
+		if (++receivedBits == 8) {
+			receiveByte(receivedByte);
+			receivedByte = 0;
+			receivedBits = 0;
+		}
+	}
+
+	void receiveByte(uint8_t value) {
+		switch (state) {
+			case romCommand:
+				if (value == ONEWIRE_MATCH_ROM) {
+					state = matchRom;
+					romIndex = 0;
+				} else if (value == ONEWIRE_SEARCH_ROM) {
+					state = searchRom;
+					searchBit = 0;
+					searchPhase = 0;
+				} else {
+					state = value == ONEWIRE_SKIP_ROM ? functionCommand : idle;
+				}
+				break;
+
+			case matchRom:
+				selected = selected && value == rom[romIndex];
+				state = ++romIndex < 8 ? matchRom : (selected ? functionCommand : idle);
+				break;
+
+			case functionCommand:
+				if (value == DS18B20_READ_SCRATCHPAD) {
+					state = sending;
+					transmitBit = 0;
+					transmitLength = DS18B20_SCRATCHPAD_SIZE;
+				} else {
+					if (value == DS18B20_CONVERT) {
+						scratchpad[0] = nextRaw & 0xFF;
+						scratchpad[1] = static_cast<uint16_t>(nextRaw) >> 8;
+						scratchpad[8] = dallasCrc8(scratchpad, 8);
+					}
+					state = idle;
+				}
+				break;
+
+			default:
+				break;
+		}
+	}
+};
+
+// The line, its pull-up and every sensor on it, implementing the bus type oneWireProtocol.h expects
+class simulatedBus {
+   public:
+	std::vector<simulatedSensor> sensors;
+	bool stuckLow = false;	// A short to ground
+	uint64_t now = 0;
+	unsigned timingErrors = 0;
+
+	void pullLow() {
+		if (masterLow) {
+			return;
+		}
+
+		// Each slot lasts SLOT_MIN, and the line is released for RECOVERY_MIN between slots
+		if (started && (now - fellAt < SLOT_MIN + RECOVERY_MIN || now - releasedAt < RECOVERY_MIN)) {
+			timingErrors++;
+		}
+
+		started = true;
+
+		masterLow = true;
+		fellAt = now;
+		for (simulatedSensor& sensor : sensors) {
+			if (sensor.drivesZero()) {
+				sensorLowUntil = std::max(sensorLowUntil, now + READ_ZERO_HOLD);
+			}
+		}
+	}
+
+	void release() {
+		if (!masterLow) {
+			return;
+		}
+
+		masterLow = false;
+		releasedAt = now;
+		uint64_t low = now - fellAt;
+
+		if (low >= RESET_LOW_MIN) {
+			for (simulatedSensor& sensor : sensors) {
+				sensor.state = simulatedSensor::romCommand;
+				sensor.receivedByte = 0;
+				sensor.receivedBits = 0;
+				sensor.selected = true;
+			}
+			presenceFrom = sensors.empty() ? 0 : now + PRESENCE_DELAY;
+			return;
+		}
+
+		if (low > WRITE_ONE_LOW_MAX && (low < WRITE_ZERO_LOW_MIN || low > WRITE_ZERO_LOW_MAX)) {
+			timingErrors++;	 // Neither a 1 nor a 0
+			return;
+		}
+
+		// A read slot looks like writing a 1, which sensors that are sending ignore
+		for (simulatedSensor& sensor : sensors) {
+			sensor.receiveBit(low <= WRITE_ONE_LOW_MAX);
+		}
+	}
+
+	bool read() const {
+		bool presence = presenceFrom != 0 && now >= presenceFrom && now < presenceFrom + PRESENCE_LENGTH;
+		return !(stuckLow || masterLow || now < sensorLowUntil || presence);
+	}
+
+	void delayMicroseconds(uint32_t microseconds) {
+		now += microseconds;
+	}
+
+   private:
+	bool started = false;
+	bool masterLow = false;
+	uint64_t fellAt = 0;
+	uint64_t releasedAt = 0;
+	uint64_t sensorLowUntil = 0;
+	uint64_t presenceFrom = 0;
+};
+
+static romCode makeRom(uint8_t serial0, uint8_t serial1, uint8_t serial5) {
+	romCode rom = {0x28, serial0, serial1, 0x00, 0x00, 0x00, serial5, 0};
+	rom[7] = dallasCrc8(rom.data(), 7);
+	return rom;
+}
+
+static void testResetAndPresence(testCase& test) {
+	simulatedBus bus;
+	test.check(!oneWireReset(bus), "presence on an empty bus");
+
+	bus.sensors.emplace_back(makeRom(0x01, 0x02, 0x03), 0);
+	test.check(oneWireReset(bus), "no presence from one sensor");
+	test.check(bus.sensors[0].state == simulatedSensor::romCommand, "sensor was not reset");
+
+	bus.sensors.emplace_back(makeRom(0x04, 0x05, 0x06), 0);
+	test.check(oneWireReset(bus), "no presence from two sensors");
+	test.check(bus.timingErrors == 0, "%u timing errors", bus.timingErrors);
+}
+
+/**
+ * @brief Searches the bus until the search ends, returning every ROM code found.
+ */
+static std::vector<romCode> searchAll(simulatedBus& bus) {
+	std::vector<romCode> found;
+	oneWireSearchState state = {};
+	romCode rom;
+
+	while (found.size() <= bus.sensors.size() && oneWireSearch(bus, state, rom.data())) {
+		found.push_back(rom);
+	}
+
+	return found;
+}
+
+static void testSearch(testCase& test) {
+	simulatedBus bus;
+	test.check(searchAll(bus).empty(), "found a sensor on an empty bus");
+
+	bus.sensors.emplace_back(makeRom(0x5A, 0x00, 0x00), 0);
+	std::vector<romCode> found = searchAll(bus);
+	test.check(found.size() == 1 && found[0] == bus.sensors[0].rom, "one sensor: found %zu", found.size());
+
+	// Codes that fork at the first serial bit, deep in the code and only in the CRC byte's neighbour
+	const romCode roms[] = {makeRom(0x00, 0x00, 0x00), makeRom(0x01, 0x00, 0x00), makeRom(0x01, 0x80, 0x00), makeRom(0x01, 0x80, 0x01),
+							makeRom(0xFF, 0xFF, 0xFF), makeRom(0x7E, 0x42, 0x99), makeRom(0x7E, 0x42, 0x98)};
+	bus.sensors.clear();
+	for (const romCode& rom : roms) {
+		bus.sensors.emplace_back(rom, 0);
+	}
+
+	found = searchAll(bus);
+	std::set<romCode> expected(std::begin(roms), std::end(roms));
+	std::set<romCode> unique(found.begin(), found.end());
+	test.check(found.size() == expected.size() && unique == expected, "%zu sensors: found %zu, %zu of them unique", expected.size(), found.size(),
+			   unique.size());
+
+	for (const romCode& rom : found) {
+		test.check(dallasCrc8(rom.data(), 7) == rom[7], "found a ROM code with a bad CRC");
+	}
+
+	// A sensor whose ROM code is corrupted fails the search rather than being reported
+	bus.sensors.clear();
+	romCode corrupted = makeRom(0x11, 0x22, 0x33);
+	corrupted[7] ^= 0x01;
+	bus.sensors.emplace_back(corrupted, 0);
+	oneWireSearchState state = {};
+	romCode rom;
+	test.check(!oneWireSearch(bus, state, rom.data()), "ROM code with a bad CRC was accepted");
+	test.check(bus.timingErrors == 0, "%u timing errors", bus.timingErrors);
+}
+
+static void testCrcFailures(testCase& test) {
+	simulatedBus bus;
+	bus.sensors.emplace_back(makeRom(0x01, 0x02, 0x03), 0x0191);
+	int16_t raw;
+
+	test.check(startDS18B20Conversion(bus), "conversion not started");
+	test.check(readDS18B20(bus, bus.sensors[0].rom.data(), raw) && raw == 0x0191, "good scratchpad rejected");
+
+	// One bit flipped in a temperature byte
+	bus.sensors[0].scratchpad[0] ^= 0x04;
+	test.check(!readDS18B20(bus, bus.sensors[0].rom.data(), raw), "scratchpad with a bad CRC accepted");
+
+	// No sensor answers MATCH ROM, so the scratchpad reads as all ones
+	romCode absent = makeRom(0x09, 0x09, 0x09);
+	test.check(!readDS18B20(bus, absent.data(), raw), "read from a sensor that is not on the bus");
+
+	// A line shorted to ground looks like a presence pulse and reads as all zeros, which passes the CRC
+	bus.stuckLow = true;
+	test.check(!readDS18B20(bus, bus.sensors[0].rom.data(), raw), "all zero scratchpad accepted");
+
+	uint8_t zeros[DS18B20_SCRATCHPAD_SIZE] = {};
+	test.check(!decodeScratchpad(zeros, raw), "decodeScratchpad accepted all zeros");
+	test.check(bus.timingErrors == 0, "%u timing errors", bus.timingErrors);
+}
+
+static void testConversions(testCase& test) {
+	simulatedBus bus;
+	const int16_t raws[] = {0x0191, static_cast<int16_t>(0xFF5E), 0x07D0, static_cast<int16_t>(0xFC90), 0x0000};  // 25.0625, -10.125, 125, -55, 0
+	for (uint8_t i = 0; i < 5; i++) {
+		bus.sensors.emplace_back(makeRom(0x10 + i, i * 37, 0x01), raws[i]);
+	}
+
+	int16_t raw;
+	test.check(!readDS18B20(bus, bus.sensors[0].rom.data(), raw), "power on value of 85 degrees accepted before a conversion");
+
+	test.check(startDS18B20Conversion(bus), "conversion not started");
+	for (uint8_t i = 0; i < 5; i++) {
+		bool read = readDS18B20(bus, bus.sensors[i].rom.data(), raw);
+		test.check(read && raw == raws[i], "sensor %u read %s %d, expected %d", i, read ? "as" : "failed,", raw, raws[i]);
+	}
+
+	// A new conversion is read, not the last one
+	bus.sensors[2].nextRaw = 0x0190;
+	test.check(startDS18B20Conversion(bus), "second conversion not started");
+	test.check(readDS18B20(bus, bus.sensors[2].rom.data(), raw) && raw == 0x0190, "second conversion read %d", raw);
+
+	bus.sensors.clear();
+	test.check(!startDS18B20Conversion(bus), "conversion started on an empty bus");
+	test.check(bus.timingErrors == 0, "%u timing errors", bus.timingErrors);
+}
+
+int main() {
+	std::vector<testCase> tests = {{"reset"}, {"search"}, {"crc"}, {"conversion"}};
+
+	testResetAndPresence(tests[0]);
+	testSearch(tests[1]);
+	testCrcFailures(tests[2]);
+	testConversions(tests[3]);
+
+	unsigned failed = 0;
+	for (const testCase& test : tests) {
+		printf("%s %s\n", test.failures == 0 ? "PASS" : "FAIL", test.name);
+		failed += test.failures > 0;
+	}
+
+	return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,841 @@
+// Host test for the read-only USB volume in src/virtualFat.cpp.
+//
+// Builds FAT16 and FAT32 cards in memory, lays the virtual volume out over each one, writes the
+// virtual volume to <image directory>/<case>.img and checks it independently of virtualFat.cpp:
+// the boot sector, FSInfo and backup boot sector, that the cluster count makes it FAT32, that
+// both FATs match, every cluster chain, the long and short names and each file's contents
+// against what was put on the card. Cases cover long names, a log and summary that grow between
+// two builds, more files than VIRTUAL_MAX_FILES and cards too small for a FAT32 volume of their
+// own size. When dosfstools or mtools are installed each image is also checked with fsck.fat -n
+// and read back with mdir and mtype; otherwise those checks are reported as skipped.
+//
+// Build: g++ -O2 -std=c++17 -DUSB_VIRTUAL_VOLUME=1 -Isrc tools/virtualFatTest.cpp src/virtualFat.cpp -o virtualFatTest
+// Usage: virtualFatTest [image directory]
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "virtualFat.h"
+
+namespace fs = std::filesystem;
+
+constexpr uint16_t SECTOR_SIZE = VIRTUAL_SECTOR_SIZE;
+constexpr uint8_t DIR_ENTRY_SIZE = 32;
+constexpr uint32_t END_OF_CHAIN = 0x0FFFFFFF;
+constexpr uint8_t LFN_CHARS_PER_ENTRY = 13;
+constexpr uint8_t lfnCharOffsets[LFN_CHARS_PER_ENTRY] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+
+constexpr uint8_t ATTR_READ_ONLY = 0x01;
+constexpr uint8_t ATTR_HIDDEN = 0x02;
+constexpr uint8_t ATTR_VOLUME_ID = 0x08;
+constexpr uint8_t ATTR_DIRECTORY = 0x10;
+constexpr uint8_t ATTR_ARCHIVE = 0x20;
+constexpr uint8_t ATTR_LONG_NAME = 0x0F;
+
+constexpr uint16_t WRITE_TIME = (20 << 11) | (41 << 5);				 // 20:41:00
+constexpr uint16_t WRITE_DATE = ((2023 - 1980) << 9) | (6 << 5) | 23;  // 2023-06-23
+
+typedef std::array<uint8_t, SECTOR_SIZE> sector;
+
+static uint16_t read16(const uint8_t* data) {
+	return data[0] | (data[1] << 8);
+}
+
+static uint32_t read32(const uint8_t* data) {
+	return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+static void write16(uint8_t* data, uint16_t value) {
+	data[0] = value & 0xFF;
+	data[1] = value >> 8;
+}
+
+static void write32(uint8_t* data, uint32_t value) {
+	write16(data, value & 0xFFFF);
+	write16(data + 2, value >> 16);
+}
+
+static uint8_t shortNameChecksum(const uint8_t* shortName) {
+	uint8_t sum = 0;
+	for (uint8_t i = 0; i < 11; i++) {
+		sum = ((sum & 1) << 7) + (sum >> 1) + shortName[i];
+	}
+	return sum;
+}
+
+/**
+ * @brief A FAT16 or FAT32 SD card held in memory, with only the sectors that were written stored.
+ */
+class syntheticCard {
+   public:
+	syntheticCard(bool fat32, uint32_t cardSectors, uint8_t sectorsPerCluster, bool partitioned)
+		: fat32(fat32), cardSectors(cardSectors), sectorsPerCluster(sectorsPerCluster) {
+		partitionStart = partitioned ? 2048 : 0;
+		uint32_t volumeSectors = cardSectors - partitionStart;
+		reservedSectors = fat32 ? 32 : 4;
+		rootEntries = fat32 ? 0 : 512;
+		uint32_t rootDirSectors = rootEntries * DIR_ENTRY_SIZE / SECTOR_SIZE;
+
+		// The smallest FAT that covers every cluster left after it
+		fatSectors = 1;
+		while (true) {
+			clusterCount = (volumeSectors - reservedSectors - 2 * fatSectors - rootDirSectors) / sectorsPerCluster;
+			uint32_t needed = ((clusterCount + 2) * (fat32 ? 4 : 2) + SECTOR_SIZE - 1) / SECTOR_SIZE;
+			if (needed <= fatSectors) {
+				break;
+			}
+			fatSectors = needed;
+		}
+
+		if (clusterCount < 4085 || (clusterCount >= 65525) != fat32) {
+			fprintf(stderr, "A %u sector card with %u sectors per cluster can't be %s\n", cardSectors, sectorsPerCluster, fat32 ? "FAT32" : "FAT16");
+			exit(2);
+		}
+
+		fatStart = partitionStart + reservedSectors;
+		rootDirStart = fatStart + 2 * fatSectors;
+		dataStart = rootDirStart + rootDirSectors;
+		fat.assign(clusterCount + 2, 0);
+		fat[0] = 0x0FFFFFF8;
+		fat[1] = END_OF_CHAIN;
+
+		uint8_t* boot = writable(partitionStart);
+		const uint8_t jump[] = {0xEB, 0x58, 0x90};
+		memcpy(boot, jump, sizeof(jump));
+		memcpy(boot + 3, "MSDOS5.0", 8);
+		write16(boot + 11, SECTOR_SIZE);
+		boot[13] = sectorsPerCluster;
+		write16(boot + 14, reservedSectors);
+		boot[16] = 2;
+		write16(boot + 17, rootEntries);
+		write16(boot + 19, volumeSectors <= 0xFFFF ? volumeSectors : 0);
+		boot[21] = 0xF8;
+		write16(boot + 22, fat32 ? 0 : fatSectors);
+		write32(boot + 28, partitionStart);
+		write32(boot + 32, volumeSectors > 0xFFFF ? volumeSectors : 0);
+
+		if (fat32) {
+			write32(boot + 36, fatSectors);
+			write32(boot + 44, 2);
+			write16(boot + 48, 1);
+			write16(boot + 50, 6);
+			boot[66] = 0x29;
+			write32(boot + 67, 0x1234ABCD);
+			memcpy(boot + 71, "CARD       ", 11);
+			memcpy(boot + 82, "FAT32   ", 8);
+			rootChain.push_back(allocateCluster(0));
+		} else {
+			boot[38] = 0x29;
+			write32(boot + 39, 0x1234ABCD);
+			memcpy(boot + 43, "CARD       ", 11);
+			memcpy(boot + 54, "FAT16   ", 8);
+		}
+		boot[510] = 0x55;
+		boot[511] = 0xAA;
+
+		if (partitioned) {
+			uint8_t* mbr = writable(0);
+			mbr[446 + 4] = fat32 ? 0x0C : 0x06;
+			write32(mbr + 446 + 8, partitionStart);
+			write32(mbr + 446 + 12, volumeSectors);
+			mbr[510] = 0x55;
+			mbr[511] = 0xAA;
+		}
+	}
+
+	/**
+	 * @brief Adds a file to the root directory, with long name entries if its name isn't a plain 8.3 name.
+	 */
+	void addFile(const std::string& name, const std::string& contents, uint8_t attributes = ATTR_ARCHIVE) {
+		uint8_t shortName[11];
+		uint8_t caseFlags = 0;
+		bool needsLongName = !makeShortName(name, shortName, caseFlags);
+
+		if (needsLongName) {
+			char alias[9];
+			snprintf(alias, sizeof(alias), "KEA%05u", ++aliasCount);
+			memcpy(shortName, alias, 8);
+			memset(shortName + 8, ' ', 3);
+			size_t dot = name.rfind('.');
+			for (size_t i = 0; dot != std::string::npos && i < 3 && dot + 1 + i < name.size(); i++) {
+				shortName[8 + i] = isalnum(name[dot + 1 + i]) ? toupper(name[dot + 1 + i]) : '_';
+			}
+
+			uint8_t checksum = shortNameChecksum(shortName);
+			uint8_t lfnEntries = (name.size() + LFN_CHARS_PER_ENTRY - 1) / LFN_CHARS_PER_ENTRY;
+
+			for (uint8_t order = lfnEntries; order >= 1; order--) {
+				uint8_t* entry = directoryEntry(entryCount++);
+				entry[0] = order | (order == lfnEntries ? 0x40 : 0);
+				entry[11] = ATTR_LONG_NAME;
+				entry[13] = checksum;
+
+				for (uint8_t i = 0; i < LFN_CHARS_PER_ENTRY; i++) {
+					size_t position = (order - 1) * LFN_CHARS_PER_ENTRY + i;
+					write16(entry + lfnCharOffsets[i], position < name.size() ? name[position] : (position == name.size() ? 0x0000 : 0xFFFF));
+				}
+			}
+		}
+
+		cardFile& file = files[name];
+		file.entryIndex = entryCount++;
+		file.firstEntry = file.entryIndex - (needsLongName ? (name.size() + LFN_CHARS_PER_ENTRY - 1) / LFN_CHARS_PER_ENTRY : 0);
+
+		uint8_t* entry = directoryEntry(file.entryIndex);
+		memcpy(entry, shortName, 11);
+		entry[11] = attributes;
+		entry[12] = caseFlags;
+		write16(entry + 22, WRITE_TIME);
+		write16(entry + 24, WRITE_DATE);
+
+		writeFileBytes(file, 0, contents);
+	}
+
+	/**
+	 * @brief Adds a subdirectory, which the virtual volume should leave out.
+	 */
+	void addDirectory(const char* shortName) {
+		uint8_t* entry = directoryEntry(entryCount++);
+		memcpy(entry, shortName, 11);
+		entry[11] = ATTR_DIRECTORY;
+		uint32_t cluster = allocateCluster(0);
+		write16(entry + 26, cluster & 0xFFFF);
+		write16(entry + 20, fat32 ? cluster >> 16 : 0);
+	}
+
+	/**
+	 * @brief Adds a volume label entry, which the virtual volume should leave out.
+	 */
+	void addVolumeLabel(const char* label) {
+		uint8_t* entry = directoryEntry(entryCount++);
+		memcpy(entry, label, 11);
+		entry[11] = ATTR_VOLUME_ID;
+	}
+
+	/**
+	 * @brief Deletes a file the way a FAT driver does, marking its entries and freeing its clusters.
+	 */
+	void deleteFile(const std::string& name) {
+		cardFile& file = files[name];
+		for (uint32_t index = file.firstEntry; index <= file.entryIndex; index++) {
+			directoryEntry(index)[0] = 0xE5;
+		}
+		for (uint32_t cluster : file.clusters) {
+			fat[cluster] = 0;
+		}
+		files.erase(name);
+	}
+
+	/**
+	 * @brief Appends to a file, allocating clusters after whatever was written since, as a log does.
+	 */
+	void append(const std::string& name, const std::string& extra) {
+		cardFile& file = files.at(name);
+		writeFileBytes(file, file.size, extra);
+	}
+
+	bool readSector(uint32_t lba, uint8_t* buffer) const {
+		if (lba >= cardSectors) {
+			return false;
+		}
+
+		if (lba >= fatStart && lba < fatStart + 2 * fatSectors) {
+			// Both FATs are generated from the table
+			uint32_t fatSector = (lba - fatStart) % fatSectors;
+			uint16_t entriesPerSector = SECTOR_SIZE / (fat32 ? 4 : 2);
+			memset(buffer, 0, SECTOR_SIZE);
+
+			for (uint16_t i = 0; i < entriesPerSector; i++) {
+				uint32_t cluster = fatSector * entriesPerSector + i;
+				uint32_t value = cluster < fat.size() ? fat[cluster] : 0;
+
+				if (fat32) {
+					write32(buffer + i * 4, value);
+				} else {
+					write16(buffer + i * 2, value & 0xFFFF);
+				}
+			}
+			return true;
+		}
+
+		auto stored = sectors.find(lba);
+		if (stored == sectors.end()) {
+			memset(buffer, 0, SECTOR_SIZE);
+		} else {
+			memcpy(buffer, stored->second.data(), SECTOR_SIZE);
+		}
+		return true;
+	}
+
+	uint32_t size() const {
+		return cardSectors;
+	}
+
+   private:
+	struct cardFile {
+		uint32_t firstEntry;
+		uint32_t entryIndex;  // The short entry
+		uint32_t size = 0;
+		std::vector<uint32_t> clusters;
+	};
+
+	bool fat32;
+	uint32_t cardSectors;
+	uint8_t sectorsPerCluster;
+	uint32_t partitionStart;
+	uint16_t reservedSectors;
+	uint16_t rootEntries;
+	uint32_t fatSectors;
+	uint32_t clusterCount;
+	uint32_t fatStart;
+	uint32_t rootDirStart;
+	uint32_t dataStart;
+	uint32_t nextFreeCluster = 2;
+	uint32_t entryCount = 0;
+	uint32_t aliasCount = 0;
+	std::vector<uint32_t> fat;
+	std::vector<uint32_t> rootChain;
+	std::map<std::string, cardFile> files;
+	std::unordered_map<uint32_t, sector> sectors;
+
+	uint8_t* writable(uint32_t lba) {
+		auto inserted = sectors.try_emplace(lba);
+		if (inserted.second) {
+			inserted.first->second.fill(0);
+		}
+		return inserted.first->second.data();
+	}
+
+	uint32_t clusterSector(uint32_t cluster) const {
+		return dataStart + (cluster - 2) * sectorsPerCluster;
+	}
+
+	/**
+	 * @brief Takes the next free cluster and links it after previous, if there is one.
+	 */
+	uint32_t allocateCluster(uint32_t previous) {
+		while (nextFreeCluster < fat.size() && fat[nextFreeCluster] != 0) {
+			nextFreeCluster++;
+		}
+		if (nextFreeCluster >= fat.size()) {
+			fprintf(stderr, "Synthetic card full\n");
+			exit(2);
+		}
+
+		uint32_t cluster = nextFreeCluster++;
+		fat[cluster] = END_OF_CHAIN;
+		if (previous != 0) {
+			fat[previous] = cluster;
+		}
+		return cluster;
+	}
+
+	uint8_t* directoryEntry(uint32_t index) {
+		uint32_t entriesPerSector = SECTOR_SIZE / DIR_ENTRY_SIZE;
+
+		if (!fat32) {
+			if (index >= rootEntries) {
+				fprintf(stderr, "FAT16 root directory full\n");
+				exit(2);
+			}
+			return writable(rootDirStart + index / entriesPerSector) + (index % entriesPerSector) * DIR_ENTRY_SIZE;
+		}
+
+		uint32_t entriesPerCluster = entriesPerSector * sectorsPerCluster;
+		while (index >= rootChain.size() * entriesPerCluster) {
+			rootChain.push_back(allocateCluster(rootChain.back()));
+		}
+
+		uint32_t cluster = rootChain[index / entriesPerCluster];
+		uint32_t sectorInCluster = (index % entriesPerCluster) / entriesPerSector;
+		return writable(clusterSector(cluster) + sectorInCluster) + (index % entriesPerSector) * DIR_ENTRY_SIZE;
+	}
+
+	void writeFileBytes(cardFile& file, uint32_t offset, const std::string& data) {
+		uint32_t clusterBytes = sectorsPerCluster * SECTOR_SIZE;
+
+		for (size_t i = 0; i < data.size(); i++) {
+			uint32_t position = offset + i;
+			uint32_t clusterIndex = position / clusterBytes;
+
+			while (file.clusters.size() <= clusterIndex) {
+				file.clusters.push_back(allocateCluster(file.clusters.empty() ? 0 : file.clusters.back()));
+			}
+
+			uint32_t lba = clusterSector(file.clusters[clusterIndex]) + (position % clusterBytes) / SECTOR_SIZE;
+			writable(lba)[position % SECTOR_SIZE] = data[i];
+		}
+
+		file.size = std::max<uint32_t>(file.size, offset + data.size());
+
+		uint8_t* entry = directoryEntry(file.entryIndex);
+		uint32_t firstCluster = file.clusters.empty() ? 0 : file.clusters[0];
+		write16(entry + 20, fat32 ? firstCluster >> 16 : 0);
+		write16(entry + 26, firstCluster & 0xFFFF);
+		write32(entry + 28, file.size);
+	}
+
+	/**
+	 * @brief Makes the 8.3 entry name of a name that needs no long name entries.
+	 *
+	 * @return False if the name needs long name entries.
+	 */
+	static bool makeShortName(const std::string& name, uint8_t* shortName, uint8_t& caseFlags) {
+		size_t dot = name.find('.');
+		std::string base = name.substr(0, dot);
+		std::string extension = dot == std::string::npos ? "" : name.substr(dot + 1);
+
+		if (base.empty() || base.size() > 8 || extension.size() > 3 || extension.find('.') != std::string::npos) {
+			return false;
+		}
+
+		caseFlags = 0;
+		for (const std::string* part : {&base, &extension}) {
+			bool upper = std::none_of(part->begin(), part->end(), [](char c) { return islower(c); });
+			bool lower = std::none_of(part->begin(), part->end(), [](char c) { return isupper(c); });
+
+			if (!std::all_of(part->begin(), part->end(), [](char c) { return isalnum(c) || c == '_'; }) || (!upper && !lower)) {
+				return false;
+			}
+			if (!upper) {
+				caseFlags |= part == &base ? 0x08 : 0x10;
+			}
+		}
+
+		memset(shortName, ' ', 11);
+		for (size_t i = 0; i < base.size(); i++) {
+			shortName[i] = toupper(base[i]);
+		}
+		for (size_t i = 0; i < extension.size(); i++) {
+			shortName[8 + i] = toupper(extension[i]);
+		}
+		return true;
+	}
+};
+
+static const syntheticCard* currentCard = nullptr;
+
+static bool readCurrentCard(uint32_t lba, uint8_t* buffer) {
+	return currentCard->readSector(lba, buffer);
+}
+
+// A file as the virtual volume lists it
+struct listedFile {
+	std::string name;
+	uint32_t firstCluster;
+	uint32_t size;
+	std::string contents;
+};
+
+struct testCase {
+	const char* name;
+	unsigned failures = 0;
+
+	void check(bool condition, const char* format, ...) __attribute__((format(printf, 3, 4))) {
+		if (!condition) {
+			va_list arguments;
+			va_start(arguments, format);
+			printf("  FAIL %s: ", name);
+			vprintf(format, arguments);
+			printf("\n");
+			va_end(arguments);
+			failures++;
+		}
+	}
+};
+
+static sector readVirtual(testCase& test, uint32_t lba) {
+	sector data;
+	test.check(readVirtualSector(lba, data.data()), "virtual sector %u read failed", lba);
+	return data;
+}
+
+/**
+ * @brief Reads the virtual volume as a FAT32 driver would, checking its structure on the way.
+ */
+static std::vector<listedFile> readVirtualVolume(testCase& test) {
+	std::vector<listedFile> listed;
+	sector boot = readVirtual(test, 0);
+
+	uint8_t clusterSectors = boot[13];
+	uint16_t reservedSectors = read16(&boot[14]);
+	uint32_t totalSectors = read32(&boot[32]);
+	uint32_t fatSectors = read32(&boot[36]);
+	uint32_t rootCluster = read32(&boot[44]);
+
+	test.check(boot[0] == 0xEB && boot[510] == 0x55 && boot[511] == 0xAA, "boot sector signature");
+	test.check(read16(&boot[11]) == SECTOR_SIZE, "bytes per sector %u", read16(&boot[11]));
+	test.check(clusterSectors != 0 && (clusterSectors & (clusterSectors - 1)) == 0, "sectors per cluster %u", clusterSectors);
+	test.check(boot[16] == 2 && read16(&boot[17]) == 0 && read16(&boot[19]) == 0 && read16(&boot[22]) == 0, "FAT32 BPB fields");
+	test.check(totalSectors == getVirtualSectorCount(), "boot sector says %u sectors, the host is told %u", totalSectors, getVirtualSectorCount());
+	test.check(memcmp(&boot[82], "FAT32   ", 8) == 0, "file system type");
+	test.check(readVirtual(test, read16(&boot[50])) == boot, "backup boot sector differs");
+
+	sector fsInfo = readVirtual(test, read16(&boot[48]));
+	test.check(read32(&fsInfo[0]) == 0x41615252 && read32(&fsInfo[484]) == 0x61417272 && read32(&fsInfo[508]) == 0xAA550000, "FSInfo signatures");
+
+	if (test.failures > 0 || clusterSectors == 0) {
+		return listed;
+	}
+
+	uint32_t dataStart = reservedSectors + 2 * fatSectors;
+	uint32_t clusterCount = (totalSectors - dataStart) / clusterSectors;
+	uint32_t clusterBytes = clusterSectors * SECTOR_SIZE;
+
+	// Hosts decide the FAT type from the cluster count alone
+	test.check(clusterCount >= 65525 && clusterCount < 0x0FFFFFF5, "%u clusters is not FAT32", clusterCount);
+	test.check(fatSectors * (SECTOR_SIZE / 4) >= clusterCount + 2, "FAT too small for %u clusters", clusterCount);
+
+	std::vector<uint32_t> fat;
+	for (uint32_t fatSector = 0; fatSector < fatSectors; fatSector++) {
+		sector first = readVirtual(test, reservedSectors + fatSector);
+		test.check(first == readVirtual(test, reservedSectors + fatSectors + fatSector), "FAT copies differ at sector %u", fatSector);
+
+		for (uint16_t i = 0; i < SECTOR_SIZE; i += 4) {
+			fat.push_back(read32(&first[i]) & 0x0FFFFFFF);
+		}
+	}
+	fat.resize(clusterCount + 2);
+	test.check(fat[0] == 0x0FFFFFF8 && fat[1] == END_OF_CHAIN, "reserved FAT entries");
+
+	std::vector<bool> used(clusterCount + 2, false);
+	auto followChain = [&](uint32_t cluster, const char* owner) {
+		std::vector<uint32_t> chain;
+		while (cluster != 0 && cluster < 0x0FFFFFF8) {
+			if (cluster < 2 || cluster >= clusterCount + 2 || used[cluster]) {
+				test.check(false, "%s: cluster %u is invalid or cross-linked", owner, cluster);
+				break;
+			}
+			used[cluster] = true;
+			chain.push_back(cluster);
+			cluster = fat[cluster];
+		}
+		return chain;
+	};
+
+	auto readCluster = [&](uint32_t cluster) {
+		std::string data;
+		for (uint8_t i = 0; i < clusterSectors; i++) {
+			sector bytes = readVirtual(test, dataStart + (cluster - 2) * clusterSectors + i);
+			data.append(reinterpret_cast<const char*>(bytes.data()), SECTOR_SIZE);
+		}
+		return data;
+	};
+
+	std::string directory;
+	for (uint32_t cluster : followChain(rootCluster, "root directory")) {
+		directory += readCluster(cluster);
+	}
+
+	std::set<std::string> shortNames;
+	std::string longName;
+	uint8_t longNameChecksum = 0;
+	uint8_t longNameNextOrder = 0;
+	bool sawLabel = false;
+
+	for (size_t offset = 0; offset + DIR_ENTRY_SIZE <= directory.size(); offset += DIR_ENTRY_SIZE) {
+		const uint8_t* entry = reinterpret_cast<const uint8_t*>(directory.data() + offset);
+
+		if (entry[0] == 0x00) {
+			break;
+		}
+
+		if (entry[11] == ATTR_LONG_NAME) {
+			uint8_t order = entry[0] & 0x1F;
+
+			if (entry[0] & 0x40) {
+				test.check(longNameNextOrder == 0, "long name entries out of order");
+				longName.assign(order * LFN_CHARS_PER_ENTRY, '\0');
+				longNameChecksum = entry[13];
+				longNameNextOrder = order;
+			}
+
+			test.check(order == longNameNextOrder && order > 0 && entry[13] == longNameChecksum, "broken long name entry");
+			for (uint8_t i = 0; i < LFN_CHARS_PER_ENTRY && order > 0; i++) {
+				longName[(order - 1) * LFN_CHARS_PER_ENTRY + i] = read16(entry + lfnCharOffsets[i]) & 0xFF;
+			}
+			longNameNextOrder--;
+			continue;
+		}
+
+		if (entry[11] & ATTR_VOLUME_ID) {
+			test.check(offset == 0 && memcmp(entry, "KEARECORDER", 11) == 0, "volume label");
+			sawLabel = true;
+			continue;
+		}
+
+		std::string shortName(reinterpret_cast<const char*>(entry), 11);
+		test.check(std::all_of(shortName.begin(), shortName.end(), [](char c) { return isupper(c) || isdigit(c) || c == ' ' || c == '_'; }),
+				   "short name \"%s\" has invalid characters", shortName.c_str());
+		test.check(shortNames.insert(shortName).second, "short name \"%s\" used twice", shortName.c_str());
+		test.check(entry[11] == (ATTR_READ_ONLY | ATTR_ARCHIVE), "%s attributes %02X", shortName.c_str(), entry[11]);
+		test.check(read16(entry + 22) == WRITE_TIME && read16(entry + 24) == WRITE_DATE, "%s write time not copied", shortName.c_str());
+
+		listedFile file;
+		if (!longName.empty()) {
+			test.check(longNameNextOrder == 0 && shortNameChecksum(entry) == longNameChecksum, "long name of %s doesn't match", shortName.c_str());
+			file.name = longName.substr(0, longName.find('\0'));
+			longName.clear();
+		} else {
+			file.name = shortName;
+		}
+
+		file.firstCluster = read16(entry + 26) | (read16(entry + 20) << 16);
+		file.size = read32(entry + 28);
+
+		std::vector<uint32_t> chain = followChain(file.firstCluster, file.name.c_str());
+		test.check(chain.size() == (file.size + clusterBytes - 1) / clusterBytes, "%s has %zu clusters for %u bytes", file.name.c_str(), chain.size(),
+				   file.size);
+
+		for (uint32_t cluster : chain) {
+			file.contents += readCluster(cluster);
+		}
+		if (file.contents.size() > file.size) {
+			test.check(file.contents.find_first_not_of('\0', file.size) == std::string::npos, "%s has data past its end", file.name.c_str());
+			file.contents.resize(file.size);
+		}
+
+		listed.push_back(file);
+	}
+
+	test.check(sawLabel, "no volume label");
+
+	uint32_t lostClusters = 0;
+	for (uint32_t cluster = 2; cluster < clusterCount + 2; cluster++) {
+		lostClusters += fat[cluster] != 0 && !used[cluster];
+	}
+	test.check(lostClusters == 0, "%u clusters allocated outside any chain", lostClusters);
+
+	return listed;
+}
+
+/**
+ * @brief Writes the virtual volume to a sparse image file for the external tools.
+ */
+static bool writeImage(testCase& test, const fs::path& path) {
+	int fd = open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+	if (fd < 0) {
+		test.check(false, "can't create %s", path.c_str());
+		return false;
+	}
+
+	sector zero = {};
+	for (uint32_t lba = 0; lba < getVirtualSectorCount(); lba++) {
+		sector data = readVirtual(test, lba);
+		if (data != zero) {
+			pwrite(fd, data.data(), SECTOR_SIZE, static_cast<off_t>(lba) * SECTOR_SIZE);
+		}
+	}
+
+	bool ok = ftruncate(fd, static_cast<off_t>(getVirtualSectorCount()) * SECTOR_SIZE) == 0;
+	close(fd);
+	return ok;
+}
+
+static bool haveCommand(const char* command) {
+	std::string check = std::string("command -v ") + command + " >/dev/null 2>&1";
+	return system(check.c_str()) == 0;
+}
+
+/**
+ * @brief Checks an image with fsck.fat and reads every file back with mtools, if they are installed.
+ */
+static void checkWithExternalTools(testCase& test, const fs::path& image, const std::vector<listedFile>& expected) {
+	if (haveCommand("fsck.fat")) {
+		std::string command = "fsck.fat -n '" + image.string() + "' >/dev/null";
+		test.check(system(command.c_str()) == 0, "fsck.fat -n %s reported errors", image.c_str());
+	} else {
+		printf("  SKIP %s: fsck.fat not installed\n", test.name);
+	}
+
+	if (!haveCommand("mdir") || !haveCommand("mtype")) {
+		printf("  SKIP %s: mtools not installed\n", test.name);
+		return;
+	}
+
+	setenv("MTOOLS_SKIP_CHECK", "1", 1);
+	std::string command = "mdir -i '" + image.string() + "' -b :: >/dev/null";
+	test.check(system(command.c_str()) == 0, "mdir can't list %s", image.c_str());
+
+	for (const listedFile& file : expected) {
+		command = "mtype -i '" + image.string() + "' '::" + file.name + "'";
+		FILE* pipe = popen(command.c_str(), "r");
+		std::string contents;
+		char buffer[4096];
+		size_t length;
+		while (pipe != nullptr && (length = fread(buffer, 1, sizeof(buffer), pipe)) > 0) {
+			contents.append(buffer, length);
+		}
+		test.check(pipe != nullptr && pclose(pipe) == 0 && contents == file.contents, "mtype read %s wrongly", file.name.c_str());
+	}
+}
+
+/**
+ * @brief Builds the virtual volume over a card and checks it lists exactly the expected files.
+ *
+ * @return The files as listed, to compare layouts between builds.
+ */
+static std::vector<listedFile> buildAndCheck(testCase& test, const syntheticCard& card, const std::vector<std::pair<std::string, std::string>>& expected,
+											 const std::vector<const char*>& growingFiles, const fs::path& image) {
+	currentCard = &card;
+	test.check(buildVirtualVolume(readCurrentCard, card.size(), growingFiles.data(), growingFiles.size()), "card not understood");
+	test.check(getVirtualFileCount() == expected.size(), "%u files, expected %zu", getVirtualFileCount(), expected.size());
+	test.check(getVirtualSectorCount() == std::max(card.size(), VIRTUAL_MIN_SECTORS), "virtual volume is %u sectors for a %u sector card",
+			   getVirtualSectorCount(), card.size());
+
+	std::vector<listedFile> listed = readVirtualVolume(test);
+	test.check(listed.size() == expected.size(), "listed %zu files, expected %zu", listed.size(), expected.size());
+
+	for (size_t i = 0; i < std::min(listed.size(), expected.size()); i++) {
+		test.check(listed[i].name == expected[i].first, "file %zu is \"%s\", expected \"%s\"", i, listed[i].name.c_str(), expected[i].first.c_str());
+		test.check(listed[i].contents == expected[i].second, "contents of %s differ", expected[i].first.c_str());
+	}
+
+	if (writeImage(test, image)) {
+		checkWithExternalTools(test, image, listed);
+	}
+	return listed;
+}
+
+/**
+ * @brief Makes some log-like text, different for each seed.
+ */
+static std::string makeText(size_t length, unsigned seed) {
+	std::string text;
+	while (text.size() < length) {
+		char line[64];
+		snprintf(line, sizeof(line), "2023-06-23,%02u:%02u,%u,%u.%u\r\n", seed % 24, static_cast<unsigned>(text.size() / 30 % 60), 4000 + seed,
+				 static_cast<unsigned>(text.size() % 300), seed % 10);
+		text += line;
+	}
+	text.resize(length);
+	return text;
+}
+
+/**
+ * @brief Fills a card with the same mix of files on each file system.
+ *
+ * @return The files the virtual volume should list, in the card's directory order.
+ */
+static std::vector<std::pair<std::string, std::string>> addTypicalFiles(syntheticCard& card) {
+	std::vector<std::pair<std::string, std::string>> files = {
+		{"README.TXT", makeText(700, 1)},
+		{"notes.txt", makeText(1500, 2)},						// Lower case 8.3 name
+		{"2023-Jun-01-0900_C8.csv", makeText(123457, 3)},	// Long name, many clusters
+		{"ABCDEFGHIJKLM.csv", makeText(10, 4)},				// 13 characters before the extension
+		{"abcdefghijklmnopqrstuvwxyz", makeText(5000, 5)},	// Exactly two long name entries
+		{std::string(59, 'n') + ".csv", makeText(64, 6)},		// The longest name kept
+		{"EMPTY.CSV", ""},
+	};
+
+	card.addVolumeLabel("CARD       ");
+	card.addFile("DELETED.CSV", makeText(3000, 7));
+	for (const auto& file : files) {
+		card.addFile(file.first, file.second);
+	}
+	card.addDirectory("SUBDIR     ");
+	card.addFile("HIDDEN.DAT", makeText(100, 8), ATTR_HIDDEN | ATTR_ARCHIVE);
+	card.deleteFile("DELETED.CSV");
+	return files;
+}
+
+/**
+ * @brief Checks a card with the usual files, then grows the log and summary and checks again.
+ */
+static void testGrowingLog(testCase& test, syntheticCard card, const fs::path& directory) {
+	const std::string logName = "2023-Jun-23-2041_C8.csv";
+	const std::string summaryName = "2023-Jun-23-2041_C8_summary.csv";
+	std::vector<std::pair<std::string, std::string>> expected = addTypicalFiles(card);
+
+	std::string log = makeText(40000, 10);
+	std::string summary = makeText(3000, 11);
+	card.addFile(logName, log);
+	card.addFile(summaryName, summary);
+	card.addFile("LATER.CSV", makeText(2000, 12));
+
+	// The growing files go last
+	expected.push_back({"LATER.CSV", makeText(2000, 12)});
+	expected.push_back({logName, log});
+	expected.push_back({summaryName, summary});
+
+	std::vector<const char*> growing = {logName.c_str(), summaryName.c_str()};
+	std::vector<listedFile> before = buildAndCheck(test, card, expected, growing, directory / (std::string(test.name) + ".img"));
+
+	// Appending allocates clusters after the summary's, so the log's chain is now in two runs
+	std::string logLines = makeText(70000, 13);
+	std::string summaryLines = makeText(900, 14);
+	card.append(logName, logLines);
+	card.append(summaryName, summaryLines);
+	expected[expected.size() - 2].second += logLines;
+	expected.back().second += summaryLines;
+
+	std::vector<listedFile> after = buildAndCheck(test, card, expected, growing, directory / (std::string(test.name) + "-grown.img"));
+
+	// A host that cached the first layout must still find every file where it was
+	for (size_t i = 0; i < std::min(before.size(), after.size()); i++) {
+		test.check(before[i].firstCluster == after[i].firstCluster, "%s moved from cluster %u to %u", before[i].name.c_str(), before[i].firstCluster,
+				   after[i].firstCluster);
+	}
+}
+
+/**
+ * @brief Checks that only the first VIRTUAL_MAX_FILES files are listed.
+ */
+static void testTooManyFiles(testCase& test, syntheticCard card, const fs::path& directory) {
+	std::vector<std::pair<std::string, std::string>> expected;
+
+	for (unsigned i = 0; i < VIRTUAL_MAX_FILES + 40; i++) {
+		char name[40];
+		snprintf(name, sizeof(name), "2023-Jun-%02u-%04u_C8.csv", i % 28 + 1, i);
+		std::string contents = makeText(100 + i * 37, 100 + i);
+		card.addFile(name, contents);
+
+		if (i < VIRTUAL_MAX_FILES) {
+			expected.push_back({name, contents});
+		}
+	}
+
+	buildAndCheck(test, card, expected, {}, directory / (std::string(test.name) + ".img"));
+}
+
+int main(int argc, char** argv) {
+	fs::path directory = argc > 1 ? fs::path(argv[1]) : fs::temp_directory_path();
+	std::vector<testCase> tests = {{"fat16"}, {"fat16-small"}, {"fat32-small"}, {"fat32"}, {"too-many-files"}};
+
+	// 64 MB FAT16 card, bigger than the smallest FAT32 volume
+	testGrowingLog(tests[0], syntheticCard(false, 131072, 4, false), directory);
+
+	// 20 MB FAT16 card in a partition, too small for a FAT32 volume of its own size
+	testGrowingLog(tests[1], syntheticCard(false, 40960, 1, true), directory);
+
+	// The smallest FAT32 card, one sector clusters
+	testGrowingLog(tests[2], syntheticCard(true, 70000, 1, true), directory);
+
+	// 2 GB FAT32 card, eight sector clusters on both the card and the virtual volume
+	testGrowingLog(tests[3], syntheticCard(true, 4194304, 8, true), directory);
+
+	testTooManyFiles(tests[4], syntheticCard(true, 70000, 1, false), directory);
+
+	unsigned failed = 0;
+	for (const testCase& test : tests) {
+		printf("%s %s\n", test.failures == 0 ? "PASS" : "FAIL", test.name);
+		failed += test.failures > 0;
+	}
+
+	return failed == 0 ? 0 : 1;
+}